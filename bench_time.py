@@ -1,13 +1,17 @@
 """
     Benchmarks bfs-dpu.
     Usage:
-        For a single datafile:  $ python3 bench_time.py <datafile> <expected_node_levels>
+        For a single datafile:  $ python3 bench_time.py <datafile> [<expected_node_levels>]
         For multiple datafiles: $ python3 bench_time.py
             Put the datafiles in ./data and the expected_node_levels in ./results/expected.
 
-    The expected_node_levels are used to verify the correctness of the BFS output.
+    The expected_node_levels are used to verify the correctness of the BFS output. Those that are missing are
+    generated in ./results/expected by the BFS on the host (`./bin/bfs -a cpu`).
 
-    Prints timing results to bench_results.
+    Each datafile is also run with the BFS on the host, as a baseline for the DPU runs (num_dpus 0 in bench_results).
+
+    Prints timing results to bench_results, and appends the successful runs to the calibration table
+    bench_calibration, with the statistics of their graph, for `./bin/bfs -a auto`.
 """
 
 
@@ -46,6 +50,22 @@ def get_metadata(datafile):
     return num_nodes, num_edges, max_degree_node, max_degree
 
 
+def expect(datafile, expected_node_levels):
+    """
+        Generates the expected_node_levels of a datafile with the BFS on the host.
+    """
+
+    os.makedirs(os.path.dirname(expected_node_levels) or ".", exist_ok=True)
+    run = f"./bin/bfs -a cpu -o {expected_node_levels} {datafile}"
+    process = subprocess.run(run, shell=True, stdout=subprocess.PIPE, encoding="utf-8")
+    if process.returncode > 0:
+        logging.error(f"BFS on the host failed to complete ({datafile})")
+        if os.path.exists(expected_node_levels):
+            os.remove(expected_node_levels)
+        return False
+    return True
+
+
 def bfs(datafile, expected_node_levels, alg, prt, num_dpus):
     """
         Runs specified BFS algorithm on a datafile using the specified number
@@ -63,15 +83,17 @@ def bfs(datafile, expected_node_levels, alg, prt, num_dpus):
             run, shell=True, stdout=subprocess.PIPE, encoding="utf-8")
     except Exception:
         logging.error(f"BFS failed to run ({id_str})")
-        return False, 0, 0, 0, 0, 0, 0, 0, 0
+        return False, 0, 0, 0, 0, 0, 0, 0, 0, {}
 
     if process.returncode > 0:
         logging.error(f"BFS failed to complete ({id_str})")
         if os.path.exists(res):
             os.remove(res)
-        return False, 0, 0, 0, 0, 0, 0, 0, 0
+        return False, 0, 0, 0, 0, 0, 0, 0, 0, {}
 
     times = process.stdout.split(" ")
+    values = process.stdout.split()
+    stats = dict(zip(values[::2], values[1::2]))
 
     dpu_compute_time = float(times[1])
     host_comm_time = float(times[3])
@@ -86,12 +108,12 @@ def bfs(datafile, expected_node_levels, alg, prt, num_dpus):
         logging.error(f"BFS output is incorrect ({id_str})")
         if os.path.exists(res):
             os.remove(res)
-        return False, dpu_compute_time, host_comm_time, host_aggr_time, pop_mram_time, fetch_res_time, total_alg, total_pop_fetch, total_all
+        return False, dpu_compute_time, host_comm_time, host_aggr_time, pop_mram_time, fetch_res_time, total_alg, total_pop_fetch, total_all, stats
 
     if os.path.exists(res):
         os.remove(res)
 
-    return True, dpu_compute_time, host_comm_time, host_aggr_time, pop_mram_time, fetch_res_time, total_alg, total_pop_fetch, total_all
+    return True, dpu_compute_time, host_comm_time, host_aggr_time, pop_mram_time, fetch_res_time, total_alg, total_pop_fetch, total_all, stats
 
 
 logging.basicConfig(filename='bench.error.log', level=logging.ERROR)
@@ -106,19 +128,22 @@ algs = [("top", "row"), ("top", "col"), ("top", "2d"),
 
 # Get datafiles from args.
 datafiles = []
-if len(sys.argv) > 1:
+if len(sys.argv) > 2:
     datafiles = [(sys.argv[1], sys.argv[2])]
+elif len(sys.argv) > 1:
+    datafiles = [(sys.argv[1], f"results/expected/{os.path.basename(sys.argv[1])}")]
 else:
-    data = os.listdir("data")
-    expected = os.listdir("results/expected")
-    missing = set(data) - set(expected)
-    if len(missing) > 0:
-        for f in missing:
-            print(f"Missing expected output of file {f}")
-        exit()
-    for f in data:
+    for f in os.listdir("data"):
         datafiles.append((f"data/{f}", f"results/expected/{f}"))
 
+# Generate the missing expected outputs.
+for datafile, expected in datafiles:
+    if not os.path.isfile(expected):
+        print(f"Generating expected output of file {datafile}")
+        if not expect(datafile, expected):
+            print(f"Could not generate expected output of file {datafile}")
+            exit()
+
 # Create unique output file.
 outfile = "bench_results"
 counter = 2
@@ -131,16 +156,36 @@ f = open(outfile, "w+")
 f.write("success datafile alg prt num_dpus dpu_compute_time host_comm_time host_aggr_time pop_mram_time fetch_res_time total_alg total_pop_fetch total_all\n")
 f.flush()
 
+# Open the calibration table, kept across benchmarks.
+calibration = "bench_calibration"
+is_new = not os.path.isfile(calibration)
+c = open(calibration, "a")
+if is_new:
+    c.write("datafile num_nodes num_edges avg_degree degree_skew diameter alg prt num_dpus total_alg\n")
+    c.flush()
+
 # Run benchmarks on each datafile, for each combination of bfs variation and dpu count.
 dpu_count = [8, 16, 32, 64, 128, 256, 512]
 for datafile, expected in datafiles:
+
+    # Baseline on the host. The number of DPUs is ignored.
+    success, dpu_compute_time, host_comm_time, host_aggr_time, pop_mram_time, fetch_res_time, total_alg, total_pop_fetch, total_all, stats = bfs(
+        datafile, expected, "cpu", "row", 8)
+    f.write(f"{success} {os.path.basename(datafile)} cpu row 0 {dpu_compute_time} {host_comm_time} {host_aggr_time} {pop_mram_time} {fetch_res_time} {total_alg} {total_pop_fetch} {total_all}\n")
+    f.flush()
+
     for alg, prt in algs:
         for num_dpus in dpu_count:
 
-            success, dpu_compute_time, host_comm_time, host_aggr_time, pop_mram_time, fetch_res_time, total_alg, total_pop_fetch, total_all = bfs(
+            success, dpu_compute_time, host_comm_time, host_aggr_time, pop_mram_time, fetch_res_time, total_alg, total_pop_fetch, total_all, stats = bfs(
                 datafile, expected, alg, prt, num_dpus)
             # num_nodes, num_edges, max_degree_node, max_degree = get_metadata(datafile)
 
             f.write(f"{success} {os.path.basename(datafile)} {alg} {prt} {num_dpus} {dpu_compute_time} {host_comm_time} {host_aggr_time} {pop_mram_time} {fetch_res_time} {total_alg} {total_pop_fetch} {total_all}\n")
             f.flush()
+
+            if success and "diameter" in stats:
+                c.write(f"{os.path.basename(datafile)} {stats['num_nodes']} {stats['num_edges']} {stats['avg_degree']} {stats['degree_skew']} {stats['diameter']} {alg} {prt} {num_dpus} {total_alg}\n")
+                c.flush()
 f.close()
+c.close()
@@ -0,0 +1,78 @@
+#ifndef BITMAP_CACHE_H
+#define BITMAP_CACHE_H
+
+// WRAM caches for MRAM bitmaps (visited, curr_frontier) that are probed one word at a time.
+// A bitmap is copied whole into WRAM when it fits in what is left of BITMAP_CACHE_BUDGET, otherwise
+// each tasklet keeps a small direct-mapped cache of BLOCK_SIZE tiles. Bitmaps must not be written
+// while they are being probed through a cache.
+
+#include <defs.h>
+#include <mram.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Note: these are overriden by compiler flags.
+#ifndef BITMAP_CACHE_BUDGET
+#define BITMAP_CACHE_BUDGET 12288
+#endif
+#ifndef BITMAP_CACHE_TILES
+#define BITMAP_CACHE_TILES 8
+#endif
+
+struct bitmap_cache {
+  __mram_ptr uint32_t *bitmap;                                               // Cached MRAM bitmap.
+  uint32_t *wram;                                                            // WRAM copy of the whole bitmap, or 0 if it does not fit.
+  uint32_t tags[NR_TASKLETS][BITMAP_CACHE_TILES];                            // Index of the tile held in each line.
+  __dma_aligned uint32_t tiles[NR_TASKLETS][BITMAP_CACHE_TILES][BLOCK_INTS]; // Per-tasklet tile lines.
+};
+
+__dma_aligned uint32_t BITMAP_CACHE_ARENA[BITMAP_CACHE_BUDGET / sizeof(uint32_t)];
+
+// Sets up a cache for a bitmap of length len, placed at offset *used (in words) of the arena.
+// Called by every tasklet, which all compute the same layout, but only tasklet 0 sets the shared fields: all
+// tasklets must then wait on a barrier before loading, filling or probing the cache.
+static inline void bitmap_cache_init(struct bitmap_cache *c, __mram_ptr uint32_t *bitmap, uint32_t len, uint32_t *used) {
+  uint32_t size = (len + BLOCK_INTS - 1) / BLOCK_INTS * BLOCK_INTS; // Whole blocks, for mram_read.
+  bool fits = *used + size <= BITMAP_CACHE_BUDGET / sizeof(uint32_t);
+  if (me() == 0) {
+    c->bitmap = bitmap;
+    c->wram = fits ? &BITMAP_CACHE_ARENA[*used] : 0;
+  }
+  if (fits)
+    *used += size;
+
+  for (uint32_t l = 0; l < BITMAP_CACHE_TILES; ++l)
+    c->tags[me()][l] = UINT32_MAX;
+}
+
+// Copies the calling tasklet's share of the bitmap (strided by blocks) to WRAM.
+// All tasklets must call this and then wait on a barrier before probing.
+static inline void bitmap_cache_load(struct bitmap_cache *c, uint32_t len) {
+  if (c->wram)
+    for (uint32_t i = me() * BLOCK_INTS; i < len; i += BLOCK_INTS * NR_TASKLETS)
+      mram_read(&c->bitmap[i], &c->wram[i], BLOCK_SIZE);
+}
+
+// Stores a block of the bitmap that starts at index i, e.g. right after it was written to MRAM.
+static inline void bitmap_cache_fill(struct bitmap_cache *c, uint32_t i, uint32_t *block) {
+  if (c->wram)
+    for (uint32_t j = 0; j < BLOCK_INTS; ++j)
+      c->wram[i + j] = block[j];
+}
+
+// Returns the bitmap word at index idx.
+static inline uint32_t bitmap_cache_get(struct bitmap_cache *c, uint32_t idx) {
+  if (c->wram)
+    return c->wram[idx];
+
+  uint32_t tile = idx / BLOCK_INTS;
+  uint32_t line = tile % BITMAP_CACHE_TILES;
+  uint32_t *t = c->tiles[me()][line];
+  if (c->tags[me()][line] != tile) {
+    mram_read(&c->bitmap[tile * BLOCK_INTS], t, BLOCK_SIZE);
+    c->tags[me()][line] = tile;
+  }
+  return t[idx % BLOCK_INTS];
+}
+
+#endif
@@ -22,16 +22,26 @@
 #define BENCHMARK_CYCLES false
 #endif
 
+#include "bitmap-cache.h"
+#include "frontier-inbox.h"
+#include "scheduler.h"
+#include "stream.h"
+
 __host __mram_ptr void *p_used_mram_end = DPU_MRAM_HEAP_POINTER; // Points to the end of used MRAM addresses.
 
 // CSC data.
 __host __mram_ptr uint32_t *node_ptrs; // DPU's share of node_ptrs.
 __host __mram_ptr uint32_t *edges;     // DPU's share of edges.
 
+// Mailbox shared with the host. It stays in WRAM across launches.
+__host struct mailbox {
+  uint32_t level;      // Current level of the BFS. The DPU advances it at the end of each launch.
+  uint32_t nf_updated; // DPU sets this to 1 if nf has been update in this level.
+} mailbox;
+
 // BFS data.
-__host uint32_t level;                     // Current level of the BFS.
 __host uint32_t len_nf;                    // Length of next_frontier.
-__host uint32_t nf_updated;                // DPU sets this to 1 if nf has been update in this level.
+__host uint32_t len_cf;                    // Length of curr_frontier.
 __host __mram_ptr uint32_t *visited;       // Nodes that are already visited.
 __host __mram_ptr uint32_t *curr_frontier; // Nodes that are in the current frontier.
 __host __mram_ptr uint32_t *next_frontier; // Nodes that are in the next frontier.
@@ -40,9 +50,14 @@ __host __mram_ptr uint32_t *node_levels;   // OUTPUT of the BFS.
 // WRAM caches.
 __dma_aligned uint32_t F_CACHES[NR_TASKLETS][BLOCK_INTS];
 __dma_aligned uint32_t VIS_CACHES[NR_TASKLETS][BLOCK_INTS];
-__dma_aligned uint32_t EDGE_CACHES[NR_TASKLETS][BLOCK_INTS];
+__dma_aligned uint32_t EDGE_CACHES[NR_TASKLETS][STREAM_INTS];
+__dma_aligned uint32_t PTRS_CACHES[NR_TASKLETS][STREAM_INTS];
 __dma_aligned uint32_t NL_CACHES[NR_TASKLETS][32];
 
+struct bitmap_cache cf_cache;
+
+BARRIER_INIT(nf_barrier, NR_TASKLETS);
+
 #if BENCHMARK_CYCLES
 __host uint64_t cycles[NR_TASKLETS];
 #endif
@@ -53,16 +68,32 @@ int main() {
     (void)perfcounter_config(COUNT_CYCLES, true);
 #endif
 
-  if (me() == 0)
-    nf_updated = 0;
+  if (me() == 0) {
+    mailbox.nf_updated = 0;
+    sched_reset();
+  }
 
   uint32_t *f = F_CACHES[me()];
   uint32_t *vis = VIS_CACHES[me()];
-  uint32_t *edg = EDGE_CACHES[me()];
   uint32_t *nl = NL_CACHES[me()];
 
-  // Loop over next_frontier.
-  for (uint32_t i = me() * BLOCK_INTS; i < len_nf; i += BLOCK_INTS * NR_TASKLETS) {
+  // Decode the frontiers the host sent sparse.
+  inbox_decode(curr_frontier, len_cf, next_frontier, 0, f, &nf_barrier);
+
+  struct stream ptrs, edgs;
+  stream_init(&ptrs, node_ptrs, PTRS_CACHES[me()]);
+  stream_init(&edgs, edges, EDGE_CACHES[me()]);
+
+  // Bring curr_frontier to WRAM.
+  uint32_t cache_used = 0;
+  bitmap_cache_init(&cf_cache, curr_frontier, len_cf, &cache_used);
+  barrier_wait(&nf_barrier);
+  bitmap_cache_load(&cf_cache, len_cf);
+
+  barrier_wait(&nf_barrier);
+
+  // Loop over next_frontier, one block at a time.
+  for (uint32_t i = sched_claim(); i < len_nf; i = sched_claim()) {
     mram_read(&visited[i], vis, BLOCK_SIZE);
     mram_read(&next_frontier[i], f, BLOCK_SIZE);
 
@@ -77,7 +108,7 @@ int main() {
         mram_read(&node_levels[(i + j) * 32], nl, 32 * sizeof(uint32_t));
         for (uint32_t b = 0; b < 32; ++b)
           if (nf & (1 << (b % 32)))
-            nl[b] = level;
+            nl[b] = mailbox.level;
         mram_write(nl, &node_levels[(i + j) * 32], 32 * sizeof(uint32_t));
       }
 
@@ -90,28 +121,21 @@ int main() {
             uint32_t offset = 1 << (node % 32);
 
             // Get node_ptrs of this node.
-            uint32_t from = node_ptrs[node];
-            uint32_t to = node_ptrs[node + 1];
+            uint32_t from = stream_at(&ptrs, node);
+            uint32_t to = stream_at(&ptrs, node + 1);
 
             // For each neighbor.
-            for (uint32_t n = from; n < to; n += BLOCK_INTS) {
-
-              // Handle &edges[from] not being 8-byte aligned.
-              uint32_t k = 0;
-              if (n == from && from % 2 != 0) {
-                k = 1;
-                n--;
-              }
-              mram_read(&edges[n], edg, BLOCK_SIZE);
-
-              for (; k < BLOCK_INTS && n + k < to; ++k) {
+            uint32_t *edg, len;
+            stream_seek(&edgs, from, to);
+            while ((len = stream_block(&edgs, &edg)) != 0) {
+              for (uint32_t k = 0; k < len; ++k) {
                 uint32_t neighbor = edg[k];
-                uint32_t ncf = curr_frontier[neighbor / 32]; // neighbor's curr_frontier chunk.
+                uint32_t ncf = bitmap_cache_get(&cf_cache, neighbor / 32); // neighbor's curr_frontier chunk.
 
                 // If any neighbor is in curr_frontier, add node to next_frontier.
                 if (ncf & (1 << (neighbor % 32))) {
                   f[j] |= offset;
-                  nf_updated = 1;
+                  mailbox.nf_updated = 1;
                   goto outer;
                 }
               }
@@ -122,6 +146,12 @@ int main() {
     mram_write(vis, &visited[i], BLOCK_SIZE);
     mram_write(f, &next_frontier[i], BLOCK_SIZE);
   }
+
+  // Advance the level once all tasklets are done with it.
+  barrier_wait(&nf_barrier);
+  if (me() == 0)
+    mailbox.level++;
+
 #if BENCHMARK_CYCLES
   cycles[me()] = perfcounter_get();
 #endif
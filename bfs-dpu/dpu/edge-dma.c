@@ -22,6 +22,11 @@
 #define BENCHMARK_CYCLES false
 #endif
 
+#include "bitmap-cache.h"
+#include "frontier-inbox.h"
+#include "private-nf.h"
+#include "stream.h"
+
 __host __mram_ptr void *p_used_mram_end = DPU_MRAM_HEAP_POINTER; // Points to the end of used MRAM addresses.
 
 // COO data.
@@ -29,10 +34,15 @@ __host uint32_t num_edges;             // Length of nodes/dst_nodes.
 __host __mram_ptr uint32_t *nodes;     // DPU's share of node idxs.
 __host __mram_ptr uint32_t *neighbors; // DPU's share of neighbor idxs.
 
+// Mailbox shared with the host. It stays in WRAM across launches.
+__host struct mailbox {
+  uint32_t level;      // Current level of the BFS. The DPU advances it at the end of each launch.
+  uint32_t nf_updated; // DPU sets this to 1 if nf has been update in this level.
+} mailbox;
+
 // BFS data.
-__host uint32_t level;                     // Current level of the BFS.
 __host uint32_t len_nf;                    // Length of next_frontier.
-__host uint32_t nf_updated;                // DPU sets this to 1 if nf has been update in this level.
+__host uint32_t len_cf;                    // Length of curr_frontier.
 __host __mram_ptr uint32_t *visited;       // Nodes that are already visited.
 __host __mram_ptr uint32_t *curr_frontier; // Nodes that are in the current frontier.
 __host __mram_ptr uint32_t *next_frontier; // Nodes that are in the next frontier.
@@ -41,10 +51,13 @@ __host __mram_ptr uint32_t *node_levels;   // OUTPUT of the BFS.
 // WRAM caches.
 __dma_aligned uint32_t F_CACHES[NR_TASKLETS][BLOCK_INTS];
 __dma_aligned uint32_t VIS_CACHES[NR_TASKLETS][BLOCK_INTS];
-__dma_aligned uint32_t NODES_CACHES[NR_TASKLETS][BLOCK_INTS];
-__dma_aligned uint32_t NEIGHBORS_CACHES[NR_TASKLETS][BLOCK_INTS];
+__dma_aligned uint32_t NODES_CACHES[NR_TASKLETS][STREAM_INTS];
+__dma_aligned uint32_t NEIGHBORS_CACHES[NR_TASKLETS][STREAM_INTS];
 __dma_aligned uint32_t NL_CACHES[NR_TASKLETS][32];
 
+struct bitmap_cache cf_cache;
+struct bitmap_cache vis_cache;
+
 BARRIER_INIT(nf_barrier, NR_TASKLETS);
 MUTEX_INIT(nf_mutex);
 
@@ -58,60 +71,99 @@ int main() {
     (void)perfcounter_config(COUNT_CYCLES, true);
 #endif
 
-  if (me() == 0)
-    nf_updated = 0;
+  if (me() == 0) {
+    mailbox.nf_updated = 0;
+    private_nf_alloc(len_nf);
+  }
 
   uint32_t *f = F_CACHES[me()];
   uint32_t *vis = VIS_CACHES[me()];
-  uint32_t *svtx = NODES_CACHES[me()];
-  uint32_t *dvtx = NEIGHBORS_CACHES[me()];
   uint32_t *nl = NL_CACHES[me()];
 
-  // Loop over next_frontier.
-  for (uint32_t i = me() * BLOCK_INTS; i < len_nf; i += BLOCK_INTS * NR_TASKLETS) {
-    mram_read(&visited[i], vis, BLOCK_SIZE);
-    mram_read(&next_frontier[i], f, BLOCK_SIZE);
-
-    for (uint32_t j = 0; j < BLOCK_INTS && i + j < len_nf; ++j) {
-      uint32_t nf = f[j];
-      if (nf == 0)
-        continue;
-
-      vis[j] |= nf; // Update visited nodes.
-      f[j] = 0;     // Clear nf.
-
-      // Update node levels.
-      mram_read(&node_levels[(i + j) * 32], nl, 32 * sizeof(uint32_t));
-      for (uint32_t b = 0; b < 32; ++b)
-        if (nf & (1 << (b % 32)))
-          nl[b] = level;
-      mram_write(nl, &node_levels[(i + j) * 32], 32 * sizeof(uint32_t));
+  struct stream srcs, dsts;
+  stream_init(&srcs, nodes, NODES_CACHES[me()]);
+  stream_init(&dsts, neighbors, NEIGHBORS_CACHES[me()]);
+
+  // Bring curr_frontier to WRAM, then visited as it gets updated.
+  uint32_t cache_used = 0;
+  bitmap_cache_init(&cf_cache, curr_frontier, len_cf, &cache_used);
+  bitmap_cache_init(&vis_cache, visited, len_nf, &cache_used);
+  barrier_wait(&nf_barrier); // The caches are set up before the fold and the pass fill visited (see frontier-inbox.h).
+
+  // Decode the frontiers the host sent sparse. A sparse next_frontier is folded into visited right away.
+  struct inbox_fold fold = {.visited = visited, .vis_cache = &vis_cache, .node_levels = node_levels, .nl = nl, .level = mailbox.level};
+  bool folded = inbox_decode(curr_frontier, len_cf, next_frontier, &fold, f, &nf_barrier);
+
+  // Bring curr_frontier to WRAM.
+  bitmap_cache_load(&cf_cache, len_cf);
+
+  // Loop over next_frontier, unless it was folded.
+  if (!folded)
+    for (uint32_t i = me() * BLOCK_INTS; i < len_nf; i += BLOCK_INTS * NR_TASKLETS) {
+      mram_read(&visited[i], vis, BLOCK_SIZE);
+      mram_read(&next_frontier[i], f, BLOCK_SIZE);
+
+      for (uint32_t j = 0; j < BLOCK_INTS && i + j < len_nf; ++j) {
+        uint32_t nf = f[j];
+        if (nf == 0)
+          continue;
+
+        vis[j] |= nf; // Update visited nodes.
+        f[j] = 0;     // Clear nf.
+
+        // Update node levels.
+        mram_read(&node_levels[(i + j) * 32], nl, 32 * sizeof(uint32_t));
+        for (uint32_t b = 0; b < 32; ++b)
+          if (nf & (1 << (b % 32)))
+            nl[b] = mailbox.level;
+        mram_write(nl, &node_levels[(i + j) * 32], 32 * sizeof(uint32_t));
+      }
+      mram_write(vis, &visited[i], BLOCK_SIZE);
+      mram_write(f, &next_frontier[i], BLOCK_SIZE);
+      bitmap_cache_fill(&vis_cache, i, vis);
     }
-    mram_write(vis, &visited[i], BLOCK_SIZE);
-    mram_write(f, &next_frontier[i], BLOCK_SIZE);
-  }
 
   barrier_wait(&nf_barrier);
+  uint32_t *pnf = private_nf_clear(len_nf);
 
-  // Loop over edges.
-  for (uint32_t i = me() * BLOCK_INTS; i < num_edges; i += BLOCK_INTS * NR_TASKLETS) {
-    mram_read(&nodes[i], svtx, BLOCK_SIZE);
-    mram_read(&neighbors[i], dvtx, BLOCK_SIZE);
+  // Loop over this tasklet's range of edges. Neighbors are only read for edges of the curr_frontier.
+  uint32_t num_edges_tsk = num_edges / NR_TASKLETS;
+  uint32_t from = me() * num_edges_tsk;
+  uint32_t to = me() == NR_TASKLETS - 1 ? num_edges : from + num_edges_tsk;
 
-    for (uint32_t j = 0; j < BLOCK_INTS && j + i < num_edges; ++j) {
+  uint32_t *svtx, len;
+  stream_seek(&srcs, from, to);
+  for (uint32_t i = from; (len = stream_block(&srcs, &svtx)) != 0; i += len) {
+    for (uint32_t j = 0; j < len; ++j) {
       uint32_t node = svtx[j];
-      if (curr_frontier[node / 32] & (1 << (node % 32))) {
-        uint32_t neighbor = dvtx[j];
+      if (bitmap_cache_get(&cf_cache, node / 32) & (1 << (node % 32))) {
+        uint32_t neighbor = stream_at(&dsts, i + j);
         uint32_t offset = 1 << neighbor % 32;
-        if (!(visited[neighbor / 32] & offset)) {
-          mutex_lock(nf_mutex);
-          next_frontier[neighbor / 32] |= offset;
-          nf_updated = 1;
-          mutex_unlock(nf_mutex);
+        if (!(bitmap_cache_get(&vis_cache, neighbor / 32) & offset)) {
+          if (pnf) {
+            pnf[neighbor / 32] |= offset;
+            mailbox.nf_updated = 1;
+          } else {
+            mutex_lock(nf_mutex);
+            next_frontier[neighbor / 32] |= offset;
+            mailbox.nf_updated = 1;
+            mutex_unlock(nf_mutex);
+          }
         }
       }
     }
   }
+
+  // Merge private next_frontiers.
+  if (private_nf_enabled) {
+    barrier_wait(&nf_barrier);
+    private_nf_merge(next_frontier, len_nf, f);
+  }
+  // Advance the level once all tasklets are done with it.
+  barrier_wait(&nf_barrier);
+  if (me() == 0)
+    mailbox.level++;
+
 #if BENCHMARK_CYCLES
   cycles[me()] = perfcounter_get();
 #endif
@@ -0,0 +1,144 @@
+#ifndef FRONTIER_INBOX_H
+#define FRONTIER_INBOX_H
+
+// Sparse frontier updates from the host.
+// On levels where few words of a frontier are set, the host does not send curr_frontier or next_frontier as a
+// dense bitmap. It sends the 8-byte words that are set as (index, words) entries in the inbox of the frontier,
+// after a header entry whose index is the number of entries. The kernels decode the inboxes into the frontiers
+// at the start of the launch, then mark them dense again, which is also how the host leaves them on dense levels.
+// A sparse curr_frontier replaces the previous one, while a sparse next_frontier is written over the DPU's own
+// next_frontier, as the frontier sent by the host always contains it.
+// Kernels whose pass over next_frontier only folds it into visited can instead have a sparse next_frontier
+// folded directly (delta updates): only its words of visited, next_frontier and node_levels are touched, and the
+// kernel skips its pass. The WRAM copy of visited is then updated in place, as it stays in WRAM across launches,
+// and the first launch of a BFS always gets a dense next_frontier that fills it. This relies on the copy being
+// complete after each dense pass, so kernels that pass a fold must, on every launch:
+//  - set up the cache of visited with bitmap_cache_init, then wait on a barrier before inbox_decode, so that no
+//    tasklet fills its share of the copy before the cache is set up;
+//  - wait on a barrier after their dense pass over next_frontier, so that every share is filled before any
+//    tasklet probes the copy or the launch ends.
+
+#include <barrier.h>
+#include <defs.h>
+#include <mram.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "bitmap-cache.h"
+
+#define INBOX_DENSE 0xFFFFFFFF // Number of entries of an inbox whose frontier was sent dense.
+#define INBOX_BLOCK_ENTRIES 4 // Number of entries read at once. The host leaves as many spare entries after an inbox.
+
+struct inbox_entry {
+  uint32_t idx;      // Index of the 8-byte word in the frontier (number of entries in the header).
+  uint32_t reserved; // Unused.
+  uint64_t words;    // Value of the two words of the frontier.
+};
+
+__host __mram_ptr struct inbox_entry *cf_inbox; // Sparse curr_frontier.
+__host __mram_ptr struct inbox_entry *nf_inbox; // Sparse next_frontier.
+
+// Where a kernel has a sparse next_frontier folded (see inbox_decode).
+struct inbox_fold {
+  __mram_ptr uint32_t *visited;     // Visited nodes.
+  struct bitmap_cache *vis_cache;   // Cache of visited, kept in sync.
+  __mram_ptr uint32_t *node_levels; // Levels of the nodes, or 0 if the kernel does not write them when folding.
+  uint32_t *nl;                     // WRAM buffer of 32 words for node_levels.
+  uint32_t level;                   // Level of the nodes of next_frontier.
+};
+
+__dma_aligned struct inbox_entry INBOX_CACHES[NR_TASKLETS][INBOX_BLOCK_ENTRIES];
+__dma_aligned uint64_t INBOX_WORDS[NR_TASKLETS][2]; // Words of visited, then zero words of next_frontier.
+
+// Writes the count entries of an inbox to their words of frontier.
+static inline void inbox_apply(__mram_ptr struct inbox_entry *inbox, uint32_t count, __mram_ptr uint32_t *frontier) {
+  struct inbox_entry *entries = INBOX_CACHES[me()];
+  __mram_ptr uint64_t *words = (__mram_ptr uint64_t *)frontier;
+  for (uint32_t e = 1 + me() * INBOX_BLOCK_ENTRIES; e <= count; e += INBOX_BLOCK_ENTRIES * NR_TASKLETS) {
+    mram_read(&inbox[e], entries, sizeof(INBOX_CACHES[0]));
+    for (uint32_t k = 0; k < INBOX_BLOCK_ENTRIES && e + k <= count; ++k)
+      mram_write(&entries[k].words, &words[entries[k].idx], sizeof(uint64_t));
+  }
+}
+
+// Folds the count entries of nf_inbox into visited, writes their levels, and clears their words of nf.
+static inline void inbox_fold(uint32_t count, __mram_ptr uint32_t *nf, struct inbox_fold *fold) {
+  struct inbox_entry *entries = INBOX_CACHES[me()];
+  uint64_t *vis = &INBOX_WORDS[me()][0];
+  uint64_t *zero = &INBOX_WORDS[me()][1];
+  __mram_ptr uint64_t *nf_words = (__mram_ptr uint64_t *)nf;
+  __mram_ptr uint64_t *vis_words = (__mram_ptr uint64_t *)fold->visited;
+  *zero = 0;
+
+  for (uint32_t e = 1 + me() * INBOX_BLOCK_ENTRIES; e <= count; e += INBOX_BLOCK_ENTRIES * NR_TASKLETS) {
+    mram_read(&nf_inbox[e], entries, sizeof(INBOX_CACHES[0]));
+    for (uint32_t k = 0; k < INBOX_BLOCK_ENTRIES && e + k <= count; ++k) {
+      uint32_t idx = entries[k].idx;
+      uint32_t *words = (uint32_t *)&entries[k].words;
+
+      // Update visited nodes, and clear nf.
+      mram_read(&vis_words[idx], vis, sizeof(uint64_t));
+      *vis |= entries[k].words;
+      mram_write(vis, &vis_words[idx], sizeof(uint64_t));
+      mram_write(zero, &nf_words[idx], sizeof(uint64_t));
+      if (fold->vis_cache->wram) {
+        fold->vis_cache->wram[2 * idx] = ((uint32_t *)vis)[0];
+        fold->vis_cache->wram[2 * idx + 1] = ((uint32_t *)vis)[1];
+      }
+
+      // Update node levels.
+      if (fold->node_levels)
+        for (uint32_t h = 0; h < 2; ++h) {
+          if (words[h] == 0)
+            continue;
+          uint32_t base_idx = (2 * idx + h) * 32;
+          mram_read(&fold->node_levels[base_idx], fold->nl, 32 * sizeof(uint32_t));
+          for (uint32_t b = 0; b < 32; ++b)
+            if (words[h] & (1 << b))
+              fold->nl[b] = fold->level;
+          mram_write(fold->nl, &fold->node_levels[base_idx], 32 * sizeof(uint32_t));
+        }
+    }
+  }
+}
+
+// Decodes the inboxes sent by the host into curr_frontier (cf, of length len_cf) and next_frontier (nf).
+// If fold is not 0, a sparse next_frontier is folded instead, and true is returned: the kernel must then skip
+// its pass over next_frontier. Must be called by all tasklets before they read the frontiers, and after the
+// barrier that follows the setup of the cache of visited (see above). cache is a WRAM buffer of BLOCK_SIZE bytes.
+static inline bool inbox_decode(__mram_ptr uint32_t *cf, uint32_t len_cf, __mram_ptr uint32_t *nf, struct inbox_fold *fold, uint32_t *cache, barrier_t *barrier) {
+  struct inbox_entry *header = INBOX_CACHES[me()];
+  mram_read(cf_inbox, header, sizeof(struct inbox_entry));
+  uint32_t count_cf = header->idx;
+  mram_read(nf_inbox, header, sizeof(struct inbox_entry));
+  uint32_t count_nf = header->idx;
+  if (count_cf == INBOX_DENSE && count_nf == INBOX_DENSE)
+    return false;
+
+  // Clear the previous curr_frontier.
+  if (count_cf != INBOX_DENSE) {
+    for (uint32_t j = 0; j < BLOCK_INTS; ++j)
+      cache[j] = 0;
+    for (uint32_t i = me() * BLOCK_INTS; i < len_cf; i += BLOCK_INTS * NR_TASKLETS)
+      mram_write(cache, &cf[i], BLOCK_SIZE);
+  }
+  barrier_wait(barrier);
+
+  if (count_cf != INBOX_DENSE)
+    inbox_apply(cf_inbox, count_cf, cf);
+  if (count_nf != INBOX_DENSE && fold)
+    inbox_fold(count_nf, nf, fold);
+  else if (count_nf != INBOX_DENSE)
+    inbox_apply(nf_inbox, count_nf, nf);
+  barrier_wait(barrier);
+
+  // All tasklets read the headers before the first barrier.
+  if (me() == 0) {
+    header->idx = INBOX_DENSE;
+    mram_write(header, cf_inbox, sizeof(struct inbox_entry));
+    mram_write(header, nf_inbox, sizeof(struct inbox_entry));
+  }
+  return count_nf != INBOX_DENSE && fold;
+}
+
+#endif
@@ -0,0 +1,278 @@
+#include <alloc.h>
+#include <barrier.h>
+#include <defs.h>
+#include <mram.h>
+#include <mutex.h>
+#include <perfcounter.h>
+#include <seqread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define PRINT_DEBUG(fmt, ...) printf("\033[0;34mDEBUG:\033[0m   " fmt "\n", ##__VA_ARGS__)
+
+// Note: these are overriden by compiler flags.
+#ifndef NR_TASKLETS
+#define NR_TASKLETS 11
+#endif
+#ifndef BLOCK_SIZE
+#define BLOCK_SIZE 32
+#endif
+#define BLOCK_INTS (BLOCK_SIZE / sizeof(uint32_t))
+#ifndef BENCHMARK_CYCLES
+#define BENCHMARK_CYCLES false
+#endif
+
+#include "bitmap-cache.h"
+#include "frontier-inbox.h"
+#include "private-nf.h"
+#include "scheduler.h"
+#include "stream.h"
+
+// Direction of a level, set by the host before each launch.
+enum mode {
+  TopDown = 0,
+  BottomUp = 1,
+};
+
+__host __mram_ptr void *p_used_mram_end = DPU_MRAM_HEAP_POINTER; // Points to the end of used MRAM addresses.
+
+// CSR data, used by top-down levels.
+__host __mram_ptr uint32_t *node_ptrs; // DPU's share of node_ptrs.
+__host __mram_ptr uint32_t *edges;     // DPU's share of edges.
+
+// CSC data, used by bottom-up levels.
+__host __mram_ptr uint32_t *in_node_ptrs; // DPU's share of node_ptrs of the transposed matrix.
+__host __mram_ptr uint32_t *in_edges;     // DPU's share of edges of the transposed matrix.
+
+// Mailbox shared with the host. It stays in WRAM across launches.
+__host struct mailbox {
+  uint32_t level;      // Current level of the BFS. The DPU advances it at the end of each launch.
+  uint32_t nf_updated; // DPU sets this to 1 if nf has been update in this level.
+} mailbox;
+
+// BFS data.
+__host uint32_t mode;                      // Direction of the current level.
+__host uint32_t len_nf;                    // Length of next_frontier.
+__host uint32_t len_cf;                    // Length of curr_frontier.
+__host __mram_ptr uint32_t *visited;       // Nodes that are already visited.
+__host __mram_ptr uint32_t *curr_frontier; // Nodes that are in the current frontier.
+__host __mram_ptr uint32_t *next_frontier; // Nodes that are in the next frontier.
+__host __mram_ptr uint32_t *node_levels;   // OUTPUT of the BFS.
+
+// WRAM caches.
+__dma_aligned uint32_t F_CACHES[NR_TASKLETS][BLOCK_INTS];
+__dma_aligned uint32_t VIS_CACHES[NR_TASKLETS][BLOCK_INTS];
+__dma_aligned uint32_t EDGE_CACHES[NR_TASKLETS][STREAM_INTS];
+__dma_aligned uint32_t PTRS_CACHES[NR_TASKLETS][STREAM_INTS];
+__dma_aligned uint32_t NL_CACHES[NR_TASKLETS][32];
+
+struct bitmap_cache vis_cache;
+struct bitmap_cache cf_cache;
+
+BARRIER_INIT(nf_barrier, NR_TASKLETS);
+MUTEX_INIT(nf_mutex);
+
+#if BENCHMARK_CYCLES
+__host uint64_t cycles[NR_TASKLETS];
+#endif
+
+// Adds the not visited neighbors in edges[from, to) to next_frontier (or to pnf, if not 0).
+static void expand(struct stream *edgs, uint32_t from, uint32_t to, uint32_t *pnf) {
+  uint32_t *edg, len;
+  stream_seek(edgs, from, to);
+  while ((len = stream_block(edgs, &edg)) != 0) {
+    for (uint32_t k = 0; k < len; ++k) {
+      uint32_t neighbor = edg[k];
+      uint32_t nidx = neighbor / 32;
+      uint32_t offset = 1 << neighbor % 32;
+
+      if (!(bitmap_cache_get(&vis_cache, nidx) & offset)) {
+        if (pnf) {
+          pnf[nidx] |= offset;
+          mailbox.nf_updated = 1;
+        } else {
+          mutex_lock(nf_mutex);
+          next_frontier[nidx] |= offset;
+          mailbox.nf_updated = 1;
+          mutex_unlock(nf_mutex);
+        }
+      }
+    }
+  }
+}
+
+// Top-down level: expands the nodes of curr_frontier through the CSR.
+static void top_down(uint32_t *f, struct stream *ptrs, struct stream *edgs) {
+  uint32_t *pnf = private_nf_clear(len_nf);
+
+  // Loop over curr_frontier, one block at a time.
+  for (uint32_t i = sched_claim(); i < len_cf; i = sched_claim()) {
+    mram_read(&curr_frontier[i], f, BLOCK_SIZE);
+
+    for (uint32_t j = 0; j < BLOCK_INTS && i + j < len_cf; ++j) {
+      uint32_t cf = f[j];
+      if (cf == 0)
+        continue;
+
+      // For each set node in the curr_frontier.
+      for (uint32_t b = 0; b < 32; ++b) {
+        if (cf & 1 << b % 32) {
+          uint32_t node = (i + j) * 32 + b;
+
+          // Get node_ptrs of this node.
+          uint32_t from = stream_at(ptrs, node);
+          uint32_t to = stream_at(ptrs, node + 1);
+
+          // Share the neighbors of high-degree nodes with other tasklets.
+          if (to - from > 2 * SCHED_CHUNK && sched_push(from, to))
+            continue;
+
+          // For each not visited neighbor of this node, add it to next_frontier.
+          expand(edgs, from, to, pnf);
+        }
+      }
+    }
+  }
+
+  // Help with the neighbors of high-degree nodes.
+  uint32_t from, to;
+  while (sched_steal(&from, &to))
+    expand(edgs, from, to, pnf);
+
+  // Merge private next_frontiers.
+  if (private_nf_enabled) {
+    barrier_wait(&nf_barrier);
+    private_nf_merge(next_frontier, len_nf, f);
+  }
+}
+
+// Bottom-up level: looks for a parent in curr_frontier of each not visited node through the CSC.
+static void bottom_up(uint32_t *f, uint32_t *vis, struct stream *ptrs, struct stream *edgs) {
+
+  // Loop over visited, one block at a time. next_frontier was cleared before.
+  for (uint32_t i = sched_claim(); i < len_nf; i = sched_claim()) {
+    mram_read(&visited[i], vis, BLOCK_SIZE);
+    bool updated = false;
+
+    for (uint32_t j = 0; j < BLOCK_INTS; ++j)
+      f[j] = 0;
+
+    for (uint32_t j = 0; j < BLOCK_INTS && i + j < len_nf; ++j) {
+
+      // For each nonvisited node in the chunk.
+      uint32_t nonvis = ~vis[j];
+      if (nonvis != 0)
+        for (uint32_t b = 0; b < 32; ++b)
+          if (nonvis & (1 << (b % 32))) {
+            uint32_t node = (i + j) * 32 + b;
+            uint32_t offset = 1 << (node % 32);
+
+            // Get node_ptrs of this node.
+            uint32_t from = stream_at(ptrs, node);
+            uint32_t to = stream_at(ptrs, node + 1);
+
+            // For each neighbor.
+            uint32_t *edg, len;
+            stream_seek(edgs, from, to);
+            while ((len = stream_block(edgs, &edg)) != 0) {
+              for (uint32_t k = 0; k < len; ++k) {
+                uint32_t neighbor = edg[k];
+                uint32_t ncf = bitmap_cache_get(&cf_cache, neighbor / 32); // neighbor's curr_frontier chunk.
+
+                // If any neighbor is in curr_frontier, add node to next_frontier.
+                if (ncf & (1 << (neighbor % 32))) {
+                  f[j] |= offset;
+                  updated = true;
+                  goto outer;
+                }
+              }
+            }
+          outer:;
+          }
+    }
+
+    if (updated) {
+      mram_write(f, &next_frontier[i], BLOCK_SIZE);
+      mailbox.nf_updated = 1;
+    }
+  }
+}
+
+int main() {
+#if BENCHMARK_CYCLES
+  if (me() == 0)
+    (void)perfcounter_config(COUNT_CYCLES, true);
+#endif
+  if (me() == 0) {
+    mailbox.nf_updated = 0;
+    if (mode == TopDown)
+      private_nf_alloc(len_nf);
+    sched_reset();
+  }
+
+  uint32_t *f = F_CACHES[me()];
+  uint32_t *vis = VIS_CACHES[me()];
+  uint32_t *nl = NL_CACHES[me()];
+
+  // Decode the frontiers the host sent sparse.
+  inbox_decode(curr_frontier, len_cf, next_frontier, 0, f, &nf_barrier);
+
+  struct stream ptrs, edgs;
+  if (mode == TopDown) {
+    stream_init(&ptrs, node_ptrs, PTRS_CACHES[me()]);
+    stream_init(&edgs, edges, EDGE_CACHES[me()]);
+  } else {
+    stream_init(&ptrs, in_node_ptrs, PTRS_CACHES[me()]);
+    stream_init(&edgs, in_edges, EDGE_CACHES[me()]);
+  }
+
+  // Only the bitmap probed by the current direction is cached, so it gets the whole budget.
+  uint32_t cache_used = 0;
+  if (mode == TopDown)
+    bitmap_cache_init(&vis_cache, visited, len_nf, &cache_used);
+  else
+    bitmap_cache_init(&cf_cache, curr_frontier, len_cf, &cache_used);
+  barrier_wait(&nf_barrier);
+  if (mode != TopDown)
+    bitmap_cache_load(&cf_cache, len_cf);
+
+  // Loop over next_frontier. Levels are written here in both directions, so node_levels follows the nf space.
+  for (uint32_t i = me() * BLOCK_INTS; i < len_nf; i += BLOCK_INTS * NR_TASKLETS) {
+    mram_read(&visited[i], vis, BLOCK_SIZE);
+    mram_read(&next_frontier[i], f, BLOCK_SIZE);
+    for (uint32_t j = 0; j < BLOCK_INTS && i + j < len_nf; ++j) {
+      uint32_t nf = f[j];
+      if (nf == 0)
+        continue;
+      vis[j] |= nf; // Update visited nodes.
+      f[j] = 0;     // Clear nf.
+
+      // Update node levels.
+      mram_read(&node_levels[(i + j) * 32], nl, 32 * sizeof(uint32_t));
+      for (uint32_t b = 0; b < 32; ++b)
+        if (nf & (1 << (b % 32)))
+          nl[b] = mailbox.level;
+      mram_write(nl, &node_levels[(i + j) * 32], 32 * sizeof(uint32_t));
+    }
+    mram_write(vis, &visited[i], BLOCK_SIZE);
+    mram_write(f, &next_frontier[i], BLOCK_SIZE);
+    if (mode == TopDown)
+      bitmap_cache_fill(&vis_cache, i, vis);
+  }
+
+  barrier_wait(&nf_barrier);
+
+  if (mode == TopDown)
+    top_down(f, &ptrs, &edgs);
+  else
+    bottom_up(f, vis, &ptrs, &edgs);
+
+  // Advance the level once all tasklets are done with it.
+  barrier_wait(&nf_barrier);
+  if (me() == 0)
+    mailbox.level++;
+
+#if BENCHMARK_CYCLES
+  cycles[me()] = perfcounter_get();
+#endif
+}
@@ -0,0 +1,143 @@
+#include <alloc.h>
+#include <barrier.h>
+#include <defs.h>
+#include <mram.h>
+#include <mutex.h>
+#include <perfcounter.h>
+#include <seqread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define PRINT_DEBUG(fmt, ...) printf("\033[0;34mDEBUG:\033[0m   " fmt "\n", ##__VA_ARGS__)
+
+// Note: these are overriden by compiler flags.
+#ifndef NR_TASKLETS
+#define NR_TASKLETS 11
+#endif
+#ifndef BLOCK_SIZE
+#define BLOCK_SIZE 32
+#endif
+#define BLOCK_INTS (BLOCK_SIZE / sizeof(uint32_t))
+#ifndef BENCHMARK_CYCLES
+#define BENCHMARK_CYCLES false
+#endif
+
+#include "bitmap-cache.h"
+#include "frontier-inbox.h"
+#include "scheduler.h"
+#include "stream.h"
+
+// Multi-source BFS: each word of the BFS data holds one bit per source (up to 32 sources) for a single node,
+// so the edges of a node are streamed once for all the sources that have not visited it yet.
+
+__host __mram_ptr void *p_used_mram_end = DPU_MRAM_HEAP_POINTER; // Points to the end of used MRAM addresses.
+
+// CSC data.
+__host __mram_ptr uint32_t *node_ptrs; // DPU's share of node_ptrs.
+__host __mram_ptr uint32_t *edges;     // DPU's share of edges.
+
+// Mailbox shared with the host. It stays in WRAM across launches.
+__host struct mailbox {
+  uint32_t level;      // Current level of the BFS. The DPU advances it at the end of each launch.
+  uint32_t nf_updated; // DPU sets this to 1 if nf has been update in this level.
+} mailbox;
+
+// BFS data. The host records node levels from the frontiers.
+__host uint32_t len_nf;                    // Length of next_frontier.
+__host uint32_t len_cf;                    // Length of curr_frontier.
+__host __mram_ptr uint32_t *visited;       // Sources that already visited each node.
+__host __mram_ptr uint32_t *curr_frontier; // Sources that have each node in their current frontier.
+__host __mram_ptr uint32_t *next_frontier; // Sources that have each node in their next frontier.
+
+// WRAM caches.
+__dma_aligned uint32_t F_CACHES[NR_TASKLETS][BLOCK_INTS];
+__dma_aligned uint32_t VIS_CACHES[NR_TASKLETS][BLOCK_INTS];
+__dma_aligned uint32_t EDGE_CACHES[NR_TASKLETS][STREAM_INTS];
+__dma_aligned uint32_t PTRS_CACHES[NR_TASKLETS][STREAM_INTS];
+
+struct bitmap_cache cf_cache;
+
+BARRIER_INIT(nf_barrier, NR_TASKLETS);
+
+#if BENCHMARK_CYCLES
+__host uint64_t cycles[NR_TASKLETS];
+#endif
+
+int main() {
+#if BENCHMARK_CYCLES
+  if (me() == 0)
+    (void)perfcounter_config(COUNT_CYCLES, true);
+#endif
+
+  if (me() == 0) {
+    mailbox.nf_updated = 0;
+    sched_reset();
+  }
+
+  uint32_t *f = F_CACHES[me()];
+  uint32_t *vis = VIS_CACHES[me()];
+
+  // Decode the frontiers the host sent sparse.
+  inbox_decode(curr_frontier, len_cf, next_frontier, 0, f, &nf_barrier);
+
+  struct stream ptrs, edgs;
+  stream_init(&ptrs, node_ptrs, PTRS_CACHES[me()]);
+  stream_init(&edgs, edges, EDGE_CACHES[me()]);
+
+  // Bring curr_frontier to WRAM.
+  uint32_t cache_used = 0;
+  bitmap_cache_init(&cf_cache, curr_frontier, len_cf, &cache_used);
+  barrier_wait(&nf_barrier);
+  bitmap_cache_load(&cf_cache, len_cf);
+
+  barrier_wait(&nf_barrier);
+
+  // Loop over next_frontier, one block at a time.
+  for (uint32_t i = sched_claim(); i < len_nf; i = sched_claim()) {
+    mram_read(&visited[i], vis, BLOCK_SIZE);
+    mram_read(&next_frontier[i], f, BLOCK_SIZE);
+
+    for (uint32_t j = 0; j < BLOCK_INTS && i + j < len_nf; ++j) {
+      vis[j] |= f[j]; // Update visited sources.
+      f[j] = 0;       // Clear nf.
+
+      // Sources that did not visit this node yet.
+      uint32_t need = ~vis[j];
+      if (need == 0)
+        continue;
+
+      // Get node_ptrs of this node.
+      uint32_t node = i + j;
+      uint32_t from = stream_at(&ptrs, node);
+      uint32_t to = stream_at(&ptrs, node + 1);
+
+      // Add the node to the next_frontier of the sources that have any neighbor in their curr_frontier.
+      uint32_t *edg, len;
+      stream_seek(&edgs, from, to);
+      while (need != 0 && (len = stream_block(&edgs, &edg)) != 0) {
+        for (uint32_t k = 0; k < len; ++k) {
+          uint32_t found = bitmap_cache_get(&cf_cache, edg[k]) & need;
+          if (found == 0)
+            continue;
+
+          f[j] |= found;
+          need &= ~found;
+          mailbox.nf_updated = 1;
+          if (need == 0)
+            break;
+        }
+      }
+    }
+    mram_write(vis, &visited[i], BLOCK_SIZE);
+    mram_write(f, &next_frontier[i], BLOCK_SIZE);
+  }
+
+  // Advance the level once all tasklets are done with it.
+  barrier_wait(&nf_barrier);
+  if (me() == 0)
+    mailbox.level++;
+
+#if BENCHMARK_CYCLES
+  cycles[me()] = perfcounter_get();
+#endif
+}
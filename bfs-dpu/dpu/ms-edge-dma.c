@@ -0,0 +1,160 @@
+#include <alloc.h>
+#include <barrier.h>
+#include <defs.h>
+#include <mram.h>
+#include <mutex.h>
+#include <perfcounter.h>
+#include <seqread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define PRINT_DEBUG(fmt, ...) printf("\033[0;34mDEBUG:\033[0m   " fmt "\n", ##__VA_ARGS__)
+
+// Note: these are overriden by compiler flags.
+#ifndef NR_TASKLETS
+#define NR_TASKLETS 11
+#endif
+#ifndef BLOCK_SIZE
+#define BLOCK_SIZE 32
+#endif
+#define BLOCK_INTS (BLOCK_SIZE / sizeof(uint32_t))
+#ifndef BENCHMARK_CYCLES
+#define BENCHMARK_CYCLES false
+#endif
+
+#include "bitmap-cache.h"
+#include "frontier-inbox.h"
+#include "private-nf.h"
+#include "stream.h"
+
+// Multi-source BFS: each word of the BFS data holds one bit per source (up to 32 sources) for a single node,
+// so each edge is streamed once for all the sources that have its node in their current frontier.
+
+__host __mram_ptr void *p_used_mram_end = DPU_MRAM_HEAP_POINTER; // Points to the end of used MRAM addresses.
+
+// COO data.
+__host uint32_t num_edges;             // Length of nodes/dst_nodes.
+__host __mram_ptr uint32_t *nodes;     // DPU's share of node idxs.
+__host __mram_ptr uint32_t *neighbors; // DPU's share of neighbor idxs.
+
+// Mailbox shared with the host. It stays in WRAM across launches.
+__host struct mailbox {
+  uint32_t level;      // Current level of the BFS. The DPU advances it at the end of each launch.
+  uint32_t nf_updated; // DPU sets this to 1 if nf has been update in this level.
+} mailbox;
+
+// BFS data. The host records node levels from the frontiers.
+__host uint32_t len_nf;                    // Length of next_frontier.
+__host uint32_t len_cf;                    // Length of curr_frontier.
+__host __mram_ptr uint32_t *visited;       // Sources that already visited each node.
+__host __mram_ptr uint32_t *curr_frontier; // Sources that have each node in their current frontier.
+__host __mram_ptr uint32_t *next_frontier; // Sources that have each node in their next frontier.
+
+// WRAM caches.
+__dma_aligned uint32_t F_CACHES[NR_TASKLETS][BLOCK_INTS];
+__dma_aligned uint32_t VIS_CACHES[NR_TASKLETS][BLOCK_INTS];
+__dma_aligned uint32_t NODES_CACHES[NR_TASKLETS][STREAM_INTS];
+__dma_aligned uint32_t NEIGHBORS_CACHES[NR_TASKLETS][STREAM_INTS];
+
+struct bitmap_cache cf_cache;
+struct bitmap_cache vis_cache;
+
+BARRIER_INIT(nf_barrier, NR_TASKLETS);
+MUTEX_INIT(nf_mutex);
+
+#if BENCHMARK_CYCLES
+__host uint64_t cycles[NR_TASKLETS];
+#endif
+
+int main() {
+#if BENCHMARK_CYCLES
+  if (me() == 0)
+    (void)perfcounter_config(COUNT_CYCLES, true);
+#endif
+
+  if (me() == 0) {
+    mailbox.nf_updated = 0;
+    private_nf_alloc(len_nf);
+  }
+
+  uint32_t *f = F_CACHES[me()];
+  uint32_t *vis = VIS_CACHES[me()];
+
+  struct stream srcs, dsts;
+  stream_init(&srcs, nodes, NODES_CACHES[me()]);
+  stream_init(&dsts, neighbors, NEIGHBORS_CACHES[me()]);
+
+  // Bring curr_frontier to WRAM, then visited as it gets updated.
+  uint32_t cache_used = 0;
+  bitmap_cache_init(&cf_cache, curr_frontier, len_cf, &cache_used);
+  bitmap_cache_init(&vis_cache, visited, len_nf, &cache_used);
+  barrier_wait(&nf_barrier); // The caches are set up before the fold and the pass fill visited (see frontier-inbox.h).
+
+  // Decode the frontiers the host sent sparse. A sparse next_frontier is folded into visited right away.
+  struct inbox_fold fold = {.visited = visited, .vis_cache = &vis_cache};
+  bool folded = inbox_decode(curr_frontier, len_cf, next_frontier, &fold, f, &nf_barrier);
+
+  // Bring curr_frontier to WRAM.
+  bitmap_cache_load(&cf_cache, len_cf);
+
+  // Loop over next_frontier, unless it was folded.
+  if (!folded)
+    for (uint32_t i = me() * BLOCK_INTS; i < len_nf; i += BLOCK_INTS * NR_TASKLETS) {
+      mram_read(&visited[i], vis, BLOCK_SIZE);
+      mram_read(&next_frontier[i], f, BLOCK_SIZE);
+      for (uint32_t j = 0; j < BLOCK_INTS && i + j < len_nf; ++j) {
+        vis[j] |= f[j]; // Update visited sources.
+        f[j] = 0;       // Clear nf.
+      }
+      mram_write(vis, &visited[i], BLOCK_SIZE);
+      mram_write(f, &next_frontier[i], BLOCK_SIZE);
+      bitmap_cache_fill(&vis_cache, i, vis);
+    }
+
+  barrier_wait(&nf_barrier);
+  uint32_t *pnf = private_nf_clear(len_nf);
+
+  // Loop over this tasklet's range of edges. Neighbors are only read for edges of the curr_frontier.
+  uint32_t num_edges_tsk = num_edges / NR_TASKLETS;
+  uint32_t from = me() * num_edges_tsk;
+  uint32_t to = me() == NR_TASKLETS - 1 ? num_edges : from + num_edges_tsk;
+
+  uint32_t *svtx, len;
+  stream_seek(&srcs, from, to);
+  for (uint32_t i = from; (len = stream_block(&srcs, &svtx)) != 0; i += len) {
+    for (uint32_t j = 0; j < len; ++j) {
+      uint32_t cf = bitmap_cache_get(&cf_cache, svtx[j]);
+      if (cf == 0)
+        continue;
+
+      uint32_t neighbor = stream_at(&dsts, i + j);
+      uint32_t bits = cf & ~bitmap_cache_get(&vis_cache, neighbor);
+      if (bits == 0)
+        continue;
+
+      if (pnf) {
+        pnf[neighbor] |= bits;
+        mailbox.nf_updated = 1;
+      } else {
+        mutex_lock(nf_mutex);
+        next_frontier[neighbor] |= bits;
+        mailbox.nf_updated = 1;
+        mutex_unlock(nf_mutex);
+      }
+    }
+  }
+
+  // Merge private next_frontiers.
+  if (private_nf_enabled) {
+    barrier_wait(&nf_barrier);
+    private_nf_merge(next_frontier, len_nf, f);
+  }
+  // Advance the level once all tasklets are done with it.
+  barrier_wait(&nf_barrier);
+  if (me() == 0)
+    mailbox.level++;
+
+#if BENCHMARK_CYCLES
+  cycles[me()] = perfcounter_get();
+#endif
+}
@@ -0,0 +1,58 @@
+#ifndef PRIVATE_NF_H
+#define PRIVATE_NF_H
+
+// Per-tasklet WRAM copies of next_frontier.
+// Tasklets set discovered nodes in their own copy without taking nf_mutex, and the copies are
+// OR-merged into the MRAM next_frontier after a barrier. Only used when NR_TASKLETS copies fit
+// in PRIVATE_NF_BUDGET bytes of WRAM heap, otherwise kernels fall back to the nf_mutex path.
+
+#include <alloc.h>
+#include <defs.h>
+#include <mram.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Note: this is overriden by compiler flags.
+#ifndef PRIVATE_NF_BUDGET
+#define PRIVATE_NF_BUDGET 24576
+#endif
+
+uint32_t *private_nf[NR_TASKLETS]; // Private next_frontier of each tasklet.
+bool private_nf_enabled;           // Whether the private next_frontiers fit in WRAM.
+
+// Allocates the private next_frontiers of length len. Must be called by tasklet 0 before a barrier.
+static inline void private_nf_alloc(uint32_t len) {
+  uint32_t size = (len * sizeof(uint32_t) + 7) & ~7; // mem_alloc returns 8-byte aligned buffers.
+  private_nf_enabled = size * NR_TASKLETS <= PRIVATE_NF_BUDGET;
+  if (!private_nf_enabled)
+    return;
+
+  mem_reset();
+  for (uint32_t t = 0; t < NR_TASKLETS; ++t)
+    private_nf[t] = mem_alloc(size);
+}
+
+// Clears the private next_frontier of the calling tasklet and returns it, or 0 if disabled.
+static inline uint32_t *private_nf_clear(uint32_t len) {
+  if (!private_nf_enabled)
+    return 0;
+
+  uint32_t *pnf = private_nf[me()];
+  for (uint32_t i = 0; i < len; ++i)
+    pnf[i] = 0;
+  return pnf;
+}
+
+// OR-merges all private next_frontiers into nf (MRAM). Must be called by all tasklets after a barrier.
+// cache is a WRAM buffer of BLOCK_SIZE bytes.
+static inline void private_nf_merge(__mram_ptr uint32_t *nf, uint32_t len, uint32_t *cache) {
+  for (uint32_t i = me() * BLOCK_INTS; i < len; i += BLOCK_INTS * NR_TASKLETS) {
+    mram_read(&nf[i], cache, BLOCK_SIZE);
+    for (uint32_t j = 0; j < BLOCK_INTS && i + j < len; ++j)
+      for (uint32_t t = 0; t < NR_TASKLETS; ++t)
+        cache[j] |= private_nf[t][i + j];
+    mram_write(cache, &nf[i], BLOCK_SIZE);
+  }
+}
+
+#endif
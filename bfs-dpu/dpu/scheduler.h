@@ -0,0 +1,75 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+// Dynamic work distribution among the tasklets of a DPU.
+// Blocks of a frontier are handed out one at a time from a shared counter instead of a fixed stride,
+// and the edges of high-degree nodes can be queued as ranges that idle tasklets take in chunks.
+
+#include <defs.h>
+#include <mutex.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Note: these are overriden by compiler flags.
+#ifndef SCHED_CHUNK
+#define SCHED_CHUNK (16 * BLOCK_INTS) // Number of edges taken at once from a queued range.
+#endif
+#ifndef SCHED_QUEUE_LEN
+#define SCHED_QUEUE_LEN 32 // Maximum number of queued edge ranges.
+#endif
+
+struct sched_range {
+  uint32_t from;
+  uint32_t to;
+};
+
+uint32_t sched_next;                             // Index of the next block to hand out.
+uint32_t sched_queue_len;                        // Number of queued edge ranges.
+struct sched_range sched_queue[SCHED_QUEUE_LEN]; // Queued edge ranges.
+
+MUTEX_INIT(sched_mutex);
+
+// Resets the scheduler. Must be called by tasklet 0 before a barrier.
+static inline void sched_reset(void) {
+  sched_next = 0;
+  sched_queue_len = 0;
+}
+
+// Returns the first index of the next block of BLOCK_INTS words to process.
+static inline uint32_t sched_claim(void) {
+  mutex_lock(sched_mutex);
+  uint32_t i = sched_next++;
+  mutex_unlock(sched_mutex);
+  return i * BLOCK_INTS;
+}
+
+// Queues the edge range [from, to) for any tasklet to process. Returns false if the queue is full.
+static inline bool sched_push(uint32_t from, uint32_t to) {
+  bool pushed = false;
+  mutex_lock(sched_mutex);
+  if (sched_queue_len < SCHED_QUEUE_LEN) {
+    sched_queue[sched_queue_len++] = (struct sched_range){from, to};
+    pushed = true;
+  }
+  mutex_unlock(sched_mutex);
+  return pushed;
+}
+
+// Takes at most SCHED_CHUNK edges from the queued ranges. Returns false if the queue is empty.
+static inline bool sched_steal(uint32_t *from, uint32_t *to) {
+  bool stolen = false;
+  mutex_lock(sched_mutex);
+  if (sched_queue_len > 0) {
+    struct sched_range *r = &sched_queue[sched_queue_len - 1];
+    *from = r->from;
+    *to = r->to - r->from > SCHED_CHUNK ? r->from + SCHED_CHUNK : r->to;
+    r->from = *to;
+    if (r->from == r->to)
+      sched_queue_len--;
+    stolen = true;
+  }
+  mutex_unlock(sched_mutex);
+  return stolen;
+}
+
+#endif
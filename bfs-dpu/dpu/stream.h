@@ -0,0 +1,71 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+// Buffered reader over an MRAM array of words.
+// Each refill reads a window of STREAM_INTS words (two blocks) with a single DMA, starting at the
+// requested index aligned down to 8 bytes. Callers can therefore start anywhere in the array, and
+// consecutive ranges that fall in the same window (e.g. the edges of neighboring nodes) are not read again.
+// Note: mram_read only stalls the calling tasklet, so DMA latency is hidden by the other tasklets
+// rather than by prefetching into a second buffer.
+
+#include <mram.h>
+#include <stdint.h>
+
+#define STREAM_INTS (2 * BLOCK_INTS)
+
+struct stream {
+  __mram_ptr uint32_t *src; // MRAM array.
+  uint32_t *buf;            // WRAM window of STREAM_INTS words.
+  uint32_t buf_start;       // Index of src held in buf[0].
+  uint32_t buf_len;         // Number of valid words in buf.
+  uint32_t pos;             // Next index of the range to read.
+  uint32_t end;             // Index one past the end of the range.
+};
+
+static inline void stream_init(struct stream *s, __mram_ptr uint32_t *src, uint32_t *buf) {
+  s->src = src;
+  s->buf = buf;
+  s->buf_start = 0;
+  s->buf_len = 0;
+  s->pos = 0;
+  s->end = 0;
+}
+
+// Reads the window containing src[idx].
+static inline void stream_fill(struct stream *s, uint32_t idx) {
+  s->buf_start = idx & ~1; // src is 8-byte aligned.
+  s->buf_len = STREAM_INTS;
+  mram_read(&s->src[s->buf_start], s->buf, STREAM_INTS * sizeof(uint32_t));
+}
+
+// Returns src[idx].
+static inline uint32_t stream_at(struct stream *s, uint32_t idx) {
+  if (idx - s->buf_start >= s->buf_len)
+    stream_fill(s, idx);
+  return s->buf[idx - s->buf_start];
+}
+
+// Sets the range [from, to) to be read by stream_block.
+static inline void stream_seek(struct stream *s, uint32_t from, uint32_t to) {
+  s->pos = from;
+  s->end = to;
+}
+
+// Points *block to the next buffered words of the range and returns their count, or 0 at the end of the range.
+static inline uint32_t stream_block(struct stream *s, uint32_t **block) {
+  if (s->pos >= s->end)
+    return 0;
+  if (s->pos - s->buf_start >= s->buf_len)
+    stream_fill(s, s->pos);
+
+  uint32_t off = s->pos - s->buf_start;
+  uint32_t len = s->buf_len - off;
+  if (len > s->end - s->pos)
+    len = s->end - s->pos;
+
+  *block = &s->buf[off];
+  s->pos += len;
+  return len;
+}
+
+#endif
@@ -22,17 +22,42 @@
 #define BENCHMARK_CYCLES false
 #endif
 
+#include "bitmap-cache.h"
+#include "frontier-inbox.h"
+#include "private-nf.h"
+#include "scheduler.h"
+#include "stream.h"
+
 __host __mram_ptr void *p_used_mram_end = DPU_MRAM_HEAP_POINTER; // Points to the end of used MRAM addresses.
 
 // CSR data.
 __host __mram_ptr uint32_t *node_ptrs; // DPU's share of node_ptrs.
 __host __mram_ptr uint32_t *edges;     // DPU's share of edges.
 
+// Streamed edges. When they do not fit in MRAM, the host runs a level in one launch per segment of the rows, with the
+// edges of the segment in edges. Only the first launch of a level folds next_frontier into visited, and only the
+// last one advances the level. The edges of the nodes are clamped to those of the segment, as the rows of a word
+// whose edges do not fit in MRAM are split over several segments. The defaults run a whole level with all the edges.
+#define SEG_FIRST 1 // First launch of the level.
+#define SEG_LAST 2  // Last launch of the level.
+__host struct segment {
+  uint32_t from;     // First word of curr_frontier of the segment.
+  uint32_t to;       // Word of curr_frontier past the segment.
+  uint32_t base;     // Index of the first edge of the segment in node_ptrs.
+  uint32_t end;      // Index of the edge past the segment in node_ptrs.
+  uint32_t flags;    // SEG_FIRST and SEG_LAST.
+  uint32_t reserved; // Unused.
+} segment = {0, UINT32_MAX, 0, UINT32_MAX, SEG_FIRST | SEG_LAST, 0};
+
+// Mailbox shared with the host. It stays in WRAM across launches.
+__host struct mailbox {
+  uint32_t level;      // Current level of the BFS. The DPU advances it at the end of each launch.
+  uint32_t nf_updated; // DPU sets this to 1 if nf has been update in this level.
+} mailbox;
+
 // BFS data.
-__host uint32_t level;                     // Current level of the BFS.
 __host uint32_t len_nf;                    // Length of next_frontier.
 __host uint32_t len_cf;                    // Length of curr_frontier.
-__host uint32_t nf_updated;                // DPU sets this to 1 if nf has been update in this level.
 __host __mram_ptr uint32_t *visited;       // Nodes that are already visited.
 __host __mram_ptr uint32_t *curr_frontier; // Nodes that are in the current frontier.
 __host __mram_ptr uint32_t *next_frontier; // Nodes that are in the next frontier.
@@ -41,9 +66,12 @@ __host __mram_ptr uint32_t *node_levels;   // OUTPUT of the BFS.
 // WRAM caches.
 __dma_aligned uint32_t F_CACHES[NR_TASKLETS][BLOCK_INTS];
 __dma_aligned uint32_t VIS_CACHES[NR_TASKLETS][BLOCK_INTS];
-__dma_aligned uint32_t EDGE_CACHES[NR_TASKLETS][BLOCK_INTS];
+__dma_aligned uint32_t EDGE_CACHES[NR_TASKLETS][STREAM_INTS];
+__dma_aligned uint32_t PTRS_CACHES[NR_TASKLETS][STREAM_INTS];
 __dma_aligned uint32_t NL_CACHES[NR_TASKLETS][32];
 
+struct bitmap_cache vis_cache;
+
 BARRIER_INIT(nf_barrier, NR_TASKLETS);
 MUTEX_INIT(nf_mutex);
 
@@ -51,44 +79,89 @@ MUTEX_INIT(nf_mutex);
 __host uint64_t cycles[NR_TASKLETS];
 #endif
 
+// Adds the not visited neighbors in edges[from, to) to next_frontier (or to pnf, if not 0).
+static void expand(struct stream *edgs, uint32_t from, uint32_t to, uint32_t *pnf) {
+  uint32_t *edg, len;
+  stream_seek(edgs, from, to);
+  while ((len = stream_block(edgs, &edg)) != 0) {
+    for (uint32_t k = 0; k < len; ++k) {
+      uint32_t neighbor = edg[k];
+      uint32_t nidx = neighbor / 32;
+      uint32_t offset = 1 << neighbor % 32;
+
+      if (!(bitmap_cache_get(&vis_cache, nidx) & offset)) {
+        if (pnf) {
+          pnf[nidx] |= offset;
+          mailbox.nf_updated = 1;
+        } else {
+          mutex_lock(nf_mutex);
+          next_frontier[nidx] |= offset;
+          mailbox.nf_updated = 1;
+          mutex_unlock(nf_mutex);
+        }
+      }
+    }
+  }
+}
+
 int main() {
 #if BENCHMARK_CYCLES
   if (me() == 0)
     (void)perfcounter_config(COUNT_CYCLES, true);
 #endif
-  if (me() == 0)
-    nf_updated = 0;
+  if (me() == 0) {
+    if (segment.flags & SEG_FIRST)
+      mailbox.nf_updated = 0;
+    private_nf_alloc(len_nf);
+    sched_reset();
+  }
 
   uint32_t *f = F_CACHES[me()];
   uint32_t *vis = VIS_CACHES[me()];
-  uint32_t *edg = EDGE_CACHES[me()];
   uint32_t *nl = NL_CACHES[me()];
 
-  // Loop over next_frontier.
-  for (uint32_t i = me() * BLOCK_INTS; i < len_nf; i += BLOCK_INTS * NR_TASKLETS) {
-    mram_read(&visited[i], vis, BLOCK_SIZE);
-    mram_read(&next_frontier[i], f, BLOCK_SIZE);
-    for (uint32_t j = 0; j < BLOCK_INTS && i + j < len_nf; ++j) {
-      uint32_t nf = f[j];
-      if (nf == 0)
-        continue;
-      vis[j] |= nf; // Update visited nodes.
-      f[j] = 0;     // Clear nf.
+  struct stream ptrs, edgs;
+  stream_init(&ptrs, node_ptrs, PTRS_CACHES[me()]);
+  stream_init(&edgs, edges, EDGE_CACHES[me()]);
+
+  uint32_t cache_used = 0;
+  bitmap_cache_init(&vis_cache, visited, len_nf, &cache_used);
+  barrier_wait(&nf_barrier); // The caches are set up before the fold and the pass fill visited (see frontier-inbox.h).
+
+  // Decode the frontiers the host sent sparse. A sparse next_frontier is folded into visited right away.
+  struct inbox_fold fold = {.visited = visited, .vis_cache = &vis_cache};
+  bool folded = inbox_decode(curr_frontier, len_cf, next_frontier, &fold, f, &nf_barrier);
+
+  // Loop over next_frontier, unless it was folded or another segment of the level already did.
+  if (!folded && (segment.flags & SEG_FIRST))
+    for (uint32_t i = me() * BLOCK_INTS; i < len_nf; i += BLOCK_INTS * NR_TASKLETS) {
+      mram_read(&visited[i], vis, BLOCK_SIZE);
+      mram_read(&next_frontier[i], f, BLOCK_SIZE);
+      for (uint32_t j = 0; j < BLOCK_INTS && i + j < len_nf; ++j) {
+        uint32_t nf = f[j];
+        if (nf == 0)
+          continue;
+        vis[j] |= nf; // Update visited nodes.
+        f[j] = 0;     // Clear nf.
+      }
+      mram_write(vis, &visited[i], BLOCK_SIZE);
+      mram_write(f, &next_frontier[i], BLOCK_SIZE);
+      bitmap_cache_fill(&vis_cache, i, vis);
     }
-    mram_write(vis, &visited[i], BLOCK_SIZE);
-    mram_write(f, &next_frontier[i], BLOCK_SIZE);
-  }
 
   barrier_wait(&nf_barrier);
+  uint32_t *pnf = private_nf_clear(len_nf);
 
-  // Loop over curr_frontier.
-  for (uint32_t i = me() * BLOCK_INTS; i < len_cf; i += BLOCK_INTS * NR_TASKLETS) {
+  // Loop over the segment of curr_frontier, one block at a time.
+  uint32_t seg_start = segment.from / BLOCK_INTS * BLOCK_INTS;
+  uint32_t seg_end = segment.to < len_cf ? segment.to : len_cf;
+  for (uint32_t i = seg_start + sched_claim(); i < seg_end; i = seg_start + sched_claim()) {
     mram_read(&curr_frontier[i], f, BLOCK_SIZE);
 
-    for (uint32_t j = 0; j < BLOCK_INTS && i + j < len_cf; ++j) {
+    for (uint32_t j = 0; j < BLOCK_INTS && i + j < seg_end; ++j) {
 
       uint32_t cf = f[j];
-      if (cf == 0)
+      if (cf == 0 || i + j < segment.from)
         continue;
 
       uint32_t base_idx = (i + j) * 32;
@@ -98,42 +171,46 @@ int main() {
       for (uint32_t b = 0; b < 32; ++b) {
         if (cf & 1 << b % 32) {
           uint32_t node = base_idx + b;
-          nl[b] = level; // Update node levels.
-
-          // Get node_ptrs of this node.
-          uint32_t from = node_ptrs[node];
-          uint32_t to = node_ptrs[node + 1];
+          nl[b] = mailbox.level; // Update node levels.
+
+          // Get node_ptrs of this node, within the edges of the segment.
+          uint32_t from = stream_at(&ptrs, node);
+          uint32_t to = stream_at(&ptrs, node + 1);
+          from = from > segment.base ? from : segment.base;
+          to = to < segment.end ? to : segment.end;
+          if (from >= to)
+            continue;
+          from -= segment.base;
+          to -= segment.base;
+
+          // Share the neighbors of high-degree nodes with other tasklets.
+          if (to - from > 2 * SCHED_CHUNK && sched_push(from, to))
+            continue;
 
           // For each not visited neighbor of this node, add it to next_frontier.
-          for (uint32_t n = from; n < to; n += BLOCK_INTS) {
-
-            // Handle &edges[from] not being 8-byte aligned.
-            uint32_t k = 0;
-            if (n == from && from % 2 != 0) {
-              k = 1;
-              n--;
-            }
-            mram_read(&edges[n], edg, BLOCK_SIZE);
-
-            for (; k < BLOCK_INTS && n + k < to; ++k) {
-              uint32_t neighbor = edg[k];
-              uint32_t nidx = neighbor / 32;
-              uint32_t offset = 1 << neighbor % 32;
-
-              if (!(visited[nidx] & offset)) {
-                mutex_lock(nf_mutex);
-                next_frontier[nidx] |= offset;
-                nf_updated = 1;
-                mutex_unlock(nf_mutex);
-              }
-            }
-          }
+          expand(&edgs, from, to, pnf);
         }
       }
       mram_write(nl, &node_levels[base_idx], 32 * sizeof(uint32_t));
     }
   }
 
+  // Help with the neighbors of high-degree nodes.
+  uint32_t from, to;
+  while (sched_steal(&from, &to))
+    expand(&edgs, from, to, pnf);
+
+  // Merge private next_frontiers.
+  if (private_nf_enabled) {
+    barrier_wait(&nf_barrier);
+    private_nf_merge(next_frontier, len_nf, f);
+  }
+
+  // Advance the level once all tasklets are done with it.
+  barrier_wait(&nf_barrier);
+  if (me() == 0 && (segment.flags & SEG_LAST))
+    mailbox.level++;
+
 #if BENCHMARK_CYCLES
   cycles[me()] = perfcounter_get();
 #endif
@@ -4,14 +4,22 @@
 #include <dpu_log.h>
 #include <dpu_memory.h>
 #include <dpu_types.h>
+#include <fcntl.h>
+#include <getopt.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <unistd.h>
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
-#define _POSIX_C_SOURCE 2 // To use GNU's getopt.
+#define _POSIX_C_SOURCE 200809L // To use GNU's getopt, mmap and pthreads.
 #define PRINT_ERROR(fmt, ...) fprintf(stderr, "\033[0;31mERROR:\033[0m   " fmt "\n", ##__VA_ARGS__)
 #define PRINT_WARNING(fmt, ...) fprintf(stderr, "\033[0;35mWARN:\033[0m    " fmt "\n", ##__VA_ARGS__)
 #define PRINT_INFO(fmt, ...) fprintf(stderr, "\033[0;32mINFO:\033[0m    " fmt "\n", ##__VA_ARGS__)
@@ -32,6 +40,40 @@
 #ifndef BENCHMARK_TIME
 #define BENCHMARK_TIME false
 #endif
+#ifndef HYBRID_ALPHA
+#define HYBRID_ALPHA 14
+#endif
+#ifndef HYBRID_BETA
+#define HYBRID_BETA 24
+#endif
+#ifndef INBOX_RATIO
+#define INBOX_RATIO 8 // Frontiers are sent sparse when at most 1/INBOX_RATIO of their 8-byte words are set.
+#endif
+#ifndef REDUCE_GRAIN
+#define REDUCE_GRAIN 16384 // Minimum number of frontier words merged by a host thread.
+#endif
+#ifndef MRAM_SIZE
+#define MRAM_SIZE (64u << 20) // Bytes of MRAM of a DPU.
+#endif
+#ifndef GRID_LEVELS
+#define GRID_LEVELS 8 // Number of levels of a BFS expected by the cost model of the 2D grids.
+#endif
+
+// Cost model of a BFS level (see predict_level), from rough throughputs of the host and of the DPUs.
+#define COST_TO_DPU_BANDWIDTH 6e9   // Bytes per second of parallel transfers to the DPUs.
+#define COST_FROM_DPU_BANDWIDTH 4e9 // Bytes per second of parallel transfers from the DPUs.
+#define COST_MERGE_BANDWIDTH 8e9    // Bytes per second of next frontiers merged by the host.
+#define COST_DPU_FREQUENCY 350e6    // DPU cycles per second.
+#define COST_CYCLES_PER_WORD 4      // DPU cycles per word of frontier or visited scanned, all tasklets together.
+#define COST_CYCLES_PER_EDGE 32     // DPU cycles per edge, all tasklets together.
+#define GRID_SAMPLES (1u << 20)     // Number of edges sampled to estimate the edges of the partitions of a grid.
+
+// Defaults of the auto-tuner, for graphs that no calibration run matches (see tune_config).
+#define TUNE_HYBRID_DIAMETER 16       // Largest estimated diameter run with the hybrid BFS.
+#define TUNE_EDGES_PER_DPU (1u << 20) // Number of edges per DPU.
+#define TUNE_MAX_DPUS 2560            // Largest number of DPUs.
+
+#define CPU_GRAIN 64 // Number of words of the bitmaps handed out at once to a thread of the host BFS (see bfs_cpu).
 
 #if BENCHMARK_TIME
 typedef struct {
@@ -66,10 +108,22 @@ Timer fetch_res_timer;
 
 #endif
 
+uint64_t frontier_bits = 0; // Total number of bits of the frontiers merged from the DPUs (row and 2D).
+uint32_t num_levels = 0;    // Total number of levels run (DPU launches).
+
+// Predicted time of a BFS level, in seconds (see predict_level).
+struct level_cost {
+  double comm; // Frontier transfers to and from the DPUs.
+  double aggr; // Merge of the next frontiers by the host.
+  double dpu;  // Run of the slowest DPU.
+} predicted;
+
 enum Algorithm {
   TopDown = 0,
   BottomUp = 1,
   Edge = 2,
+  Hybrid = 3,
+  Cpu = 4, // Direction-optimizing BFS on the host, without DPUs.
 };
 
 enum Partition {
@@ -78,10 +132,18 @@ enum Partition {
   _2D = 2,
 };
 
+// Relabelings of the nodes, applied before partitioning (see reorder_coo).
+enum Order {
+  OrderNone = 0,   // IDs of the datafile.
+  OrderDegree = 1, // By decreasing degree.
+  OrderRCM = 2,    // Reverse Cuthill-McKee.
+  OrderHub = 3,    // Nodes of above average degree first, in their order.
+};
+
 struct COO {
   uint32_t num_rows;
   uint32_t num_cols;
-  uint32_t num_edges;
+  uint64_t num_edges;
   uint32_t *row_idxs;
   uint32_t *col_idxs;
 };
@@ -89,7 +151,7 @@ struct COO {
 struct CSR {
   uint32_t num_rows;
   uint32_t num_cols;
-  uint32_t num_edges;
+  uint64_t num_edges;
   uint32_t *row_ptrs;
   uint32_t *col_idxs;
 };
@@ -97,57 +159,135 @@ struct CSR {
 struct CSC {
   uint32_t num_rows;
   uint32_t num_cols;
-  uint32_t num_edges;
+  uint64_t num_edges;
   uint32_t *col_ptrs;
   uint32_t *row_idxs;
 };
 
+// Partitions of the graph (one per DPU), in the formats used by the BFS algorithm.
+struct Graph {
+  struct COO *coo; // COO partitions (edge-centric BFS), or NULL.
+  struct CSR *csr; // CSR partitions (top-down BFS), or NULL.
+  struct CSC *csc; // CSC partitions (bottom-up BFS), or NULL.
+  void *map;       // Mapping of the graph cache file holding the partitions, or NULL if they are allocated.
+  size_t map_size; // Size of the mapping.
+};
+
+// Binary graph cache file: a header, the number of edges of each partition, row_starts and col_starts, new_ids if
+// the nodes are reordered, then the arrays of each partition (COO, then CSR, then CSC, as present in formats).
+// Every array is padded to 8 bytes.
+#define GRAPH_CACHE_MAGIC "BFSGRAPH"
+#define GRAPH_CACHE_VERSION 3
+
+enum GraphFormat {
+  FormatCOO = 1,
+  FormatCSR = 2,
+  FormatCSC = 4,
+};
+
+struct GraphCacheHeader {
+  char magic[8];      // GRAPH_CACHE_MAGIC.
+  uint32_t version;   // GRAPH_CACHE_VERSION.
+  uint32_t num_dpu;   // Number of partitions.
+  uint32_t prt;       // Partitioning (enum Partition).
+  uint32_t formats;   // Formats of the partitions (enum GraphFormat flags).
+  uint32_t num_rows;  // Number of rows of each partition (the widest row range).
+  uint32_t num_cols;  // Number of cols of each partition (the widest col range).
+  uint32_t row_div;   // Number of partitions per column of the adjacency matrix.
+  uint32_t col_div;   // Number of partitions per row of the adjacency matrix.
+  uint32_t padding;   // Number of nodes added by padding.
+  uint32_t order;     // Order of the nodes (enum Order).
+  uint64_t num_edges; // Total number of edges.
+};
+
 FILE *out;
+char *out_path;
 uint32_t num_dpu = 8;
+uint32_t num_threads = 1; // Number of host threads (defaults to the number of online CPUs).
+
+// Node ranges of the partitions (see partition_coo). Partition i has the rows from row_starts[i / col_div] and the
+// cols from col_starts[i % col_div], up to the next start. The last start is the number of nodes of the graph.
+// Every partition is as large as the widest ranges: its nodes past the end of its ranges have no edges.
+bool balanced = false; // Whether the ranges hold about as many edges each, rather than as many nodes.
+bool stream_load = false; // Whether the partitions are binned while the datafile is read (see load_partitions).
+uint32_t *row_starts;
+uint32_t *col_starts;
+
+// Grid of a 2D partitioning, chosen by choose_grid or read from a graph cache (0 x 0 until then, see grid_2d).
+uint32_t grid_row_div = 0;
+uint32_t grid_col_div = 0;
+
+// Auto-tuning of the options given as auto (see tune_config), from the statistics of the graph and a calibration
+// table of past benchmark runs (written by bench_time.py). A graph cache fixes them instead (see cache_config).
+struct graph_stats {
+  uint32_t num_nodes; // Number of nodes, without padding.
+  uint64_t num_edges; // Number of edges.
+  double avg_degree;  // Average out-degree.
+  double degree_skew; // Coefficient of variation of the out-degrees.
+  uint32_t diameter;  // Estimated diameter (see compute_stats).
+};
+const char *alg_names[] = {"top", "bot", "edge", "hybrid", "cpu"};
+const char *prt_names[] = {"row", "col", "2d"};
+bool auto_alg = false;
+bool auto_prt = false;
+bool auto_dpu = false;
+char *calibration_file = "bench_calibration";
+struct graph_stats stats; // Statistics of the graph, if has_stats (they are not computed from a graph cache).
+bool has_stats = false;
+
+// Relabeling of the nodes. The DPUs and the frontiers only see the new IDs: roots and outputs are translated.
+enum Order order = OrderNone;
+uint32_t *new_ids = 0; // New ID of each node of the datafile, or 0 if the nodes are not relabeled.
+
+// BFS roots. A roots file runs the BFS from each of its roots on the same populated MRAM.
+uint32_t *roots;
+uint32_t num_roots;
+bool batch = false; // Whether the roots come from a roots file.
+
+// Multi-source BFS runs the roots 32 at a time. Each word of the BFS data then holds one bit per source for a
+// single node, instead of one bit per node. Node levels are recorded by the host from the frontiers.
+#define MS_SOURCES 32
+bool multi_source = false;
+uint32_t nodes_per_word = 32; // Nodes per word of the BFS data (1 in multi-source BFS).
+uint32_t *ms_levels = 0;      // Level of each node for each source of the batch, or 0 if not multi-source.
+
+// Mailbox shared with the DPUs (see the DPU programs).
+struct mailbox {
+  uint32_t level;      // Current level of the BFS. DPUs advance it at the end of each launch.
+  uint32_t nf_updated; // DPU sets this to 1 if nf has been update in this level.
+};
 
 struct dpu_symbol_t mram_heap_sym;
-struct dpu_symbol_t level_sym;
-struct dpu_symbol_t nf_updated_sym;
+struct dpu_symbol_t mailbox_sym;
 
 mram_addr_t cf_addr;
 mram_addr_t nf_addr;
+mram_addr_t vis_addr;
+mram_addr_t nl_addr;
+
+// Sparse frontier transfers (see frontier-inbox.h of the DPU programs).
+#define INBOX_DENSE UINT32_MAX
+#define INBOX_BLOCK_ENTRIES 4
+struct inbox_entry {
+  uint32_t idx;      // Index of the 8-byte word in the frontier (number of entries in the header).
+  uint32_t reserved; // Unused.
+  uint64_t words;    // Value of the two words of the frontier.
+};
+mram_addr_t cf_inbox_addr;
+mram_addr_t nf_inbox_addr;
 
 struct dpu_set_t set;
 struct dpu_set_t dpu;
 
-/**
- * @fn dpu_insert_mram_array_u32
- * @brief Inserts data into the MRAM of a DPU at the last used MRAM address.
- * @param dpu_set the identifier of the DPU set.
- * @param symbol_name the name of the DPU symbol where to copy the pointer of the data.
- * @param src the host buffer containing the data to copy.
- * @param length the number of elements in the array.
- */
-void dpu_insert_mram_array_u32(struct dpu_set_t dpu, const char *symbol_name, uint32_t *src, uint32_t length) {
-
-  bool is_zero = src == 0;
-  if (is_zero)
-    src = calloc(length, sizeof(uint32_t));
-
-  // Get end of used MRAM pointer.
-  mram_addr_t p_used_mram_end;
-  DPU_ASSERT(dpu_copy_from(dpu, "p_used_mram_end", 0, &p_used_mram_end, sizeof(mram_addr_t)));
-
-  // Set the array pointer as the previous pointer.
-  DPU_ASSERT(dpu_copy_to(dpu, symbol_name, 0, &p_used_mram_end, sizeof(mram_addr_t)));
-
-  // Copy the data to MRAM.
-  size_t size = length * sizeof(uint32_t);
-  size += size % 8; // Guarantee address will be aligned on 8 bytes.
-  DPU_ASSERT(dpu_copy_to_mram(dpu.dpu, p_used_mram_end, (const uint8_t *)src, size));
-
-  // Increment end of used MRAM pointer.
-  p_used_mram_end += size;
-  DPU_ASSERT(dpu_copy_to(dpu, "p_used_mram_end", 0, &p_used_mram_end, sizeof(mram_addr_t)));
-
-  if (is_zero)
-    free(src);
-}
+// Direction-optimizing state of the hybrid BFS (see update_direction).
+struct direction {
+  uint32_t *degrees;       // Out-degree of each node, or 0 if the BFS is not hybrid.
+  uint32_t num_nodes;      // Total number of nodes.
+  uint64_t num_edges;      // Total number of edges.
+  uint64_t edges_to_check; // Number of edges out of the nodes that are not visited yet.
+  uint32_t frontier_size;  // Number of nodes in the current frontier.
+  enum Algorithm mode;     // Direction of the current level (TopDown or BottomUp).
+} direction;
 
 /**
  * @fn dpu_set_mram_array_u32
@@ -199,6 +339,444 @@ void dpu_get_u32(struct dpu_set_t dpu, const char *symbol_name, uint32_t *dst) {
   DPU_ASSERT(dpu_copy_from(dpu, symbol_name, 0, dst, sizeof(uint32_t)));
 }
 
+// MRAM layout, planned on the host. Arrays are placed at the same MRAM address on all DPUs, sized to the largest one.
+// The layout must fit MRAM_SIZE: mram_bytes computes its size before partitioning, to check that the graph fits.
+mram_addr_t mram_heap_start; // Start of the MRAM heap (initial p_used_mram_end of the DPU programs).
+mram_addr_t mram_plan_end;   // End of the MRAM arrays planned so far.
+
+// Returns the bytes taken by an MRAM array of length words, padded to 8 bytes.
+static inline uint64_t mram_array_size(uint64_t length) {
+  return ROUND_UP_TO_MULTIPLE(length * sizeof(uint32_t), 8);
+}
+
+/**
+ * @fn dpu_plan_mram_array_u32
+ * @brief Places an array at the end of the planned MRAM of all DPUs, and broadcasts its address to a DPU symbol.
+ * @param symbol_name the name of the DPU symbol where to copy the pointer of the array.
+ * @param length the number of elements of the largest array among the DPUs.
+ * @return the MRAM address of the array.
+ */
+mram_addr_t dpu_plan_mram_array_u32(const char *symbol_name, uint32_t length) {
+  mram_addr_t addr = mram_plan_end;
+  DPU_ASSERT(dpu_copy_to(set, symbol_name, 0, &addr, sizeof(mram_addr_t)));
+
+  // Guarantee the next address will be aligned on 8 bytes.
+  if (mram_plan_end + mram_array_size(length) > MRAM_SIZE) {
+    PRINT_ERROR("Array %s does not fit in the MRAM of a DPU, %lu bytes past its end.", symbol_name, mram_plan_end + mram_array_size(length) - MRAM_SIZE);
+    exit(1);
+  }
+  mram_plan_end += mram_array_size(length);
+  DPU_ASSERT(dpu_copy_to(set, "p_used_mram_end", 0, &mram_plan_end, sizeof(mram_addr_t)));
+  return addr;
+}
+
+// Arrays of each DPU staged for parallel transfers to the same MRAM address (see dpu_stage_mram_array_u32).
+struct staged_arrays {
+  uint32_t **srcs; // Host buffer of each DPU.
+  uint32_t prefix; // Number of elements that all arrays have, rounded down to 8 bytes, copied from the host buffers.
+  uint32_t stride; // Number of elements of the rest of each array, staged in rest.
+  uint32_t *rest;  // Rest of the array of each DPU, zero padded, or 0 if stride is 0.
+};
+
+/**
+ * @fn dpu_stage_mram_array_u32
+ * @brief Stages the array of each DPU for parallel transfers with the same size on all DPUs: the prefix that all
+ * arrays have is copied from the host buffers, and the rest of each array is staged in a zero padded buffer.
+ * @param srcs the host buffer of each DPU. It must outlive the staged arrays.
+ * @param lengths the number of elements of the array of each DPU.
+ * @return the staged arrays, to push with dpu_push_mram_array_u32.
+ */
+struct staged_arrays dpu_stage_mram_array_u32(uint32_t **srcs, uint32_t *lengths) {
+
+  uint32_t min_length = UINT32_MAX, max_length = 0;
+  for (uint32_t i = 0; i < num_dpu; ++i) {
+    min_length = lengths[i] < min_length ? lengths[i] : min_length;
+    max_length = lengths[i] > max_length ? lengths[i] : max_length;
+  }
+
+  struct staged_arrays staged = {.srcs = srcs, .prefix = min_length & ~1u};
+  staged.stride = ROUND_UP_TO_MULTIPLE(max_length - staged.prefix, 2);
+  if (staged.stride == 0)
+    return staged;
+  staged.rest = calloc((size_t)num_dpu * staged.stride, sizeof(uint32_t));
+  for (uint32_t i = 0; i < num_dpu; ++i)
+    memcpy(&staged.rest[(size_t)i * staged.stride], &srcs[i][staged.prefix], (size_t)(lengths[i] - staged.prefix) * sizeof(uint32_t));
+  return staged;
+}
+
+/**
+ * @fn dpu_push_mram_array_u32
+ * @brief Copies staged arrays to the same MRAM address of each DPU, with parallel transfers to the whole DPU set,
+ * and frees the staging buffer.
+ * @param addr the MRAM address of the arrays, from dpu_plan_mram_array_u32.
+ * @param staged the arrays, from dpu_stage_mram_array_u32.
+ */
+void dpu_push_mram_array_u32(mram_addr_t addr, struct staged_arrays *staged) {
+  uint32_t i = 0;
+  if (staged->prefix > 0) {
+    DPU_FOREACH(set, dpu, i) {
+      DPU_ASSERT(dpu_prepare_xfer(dpu, staged->srcs[i]));
+    }
+    DPU_ASSERT(dpu_push_xfer_symbol(set, DPU_XFER_TO_DPU, mram_heap_sym, addr, (size_t)staged->prefix * sizeof(uint32_t), DPU_XFER_DEFAULT));
+  }
+  if (staged->stride == 0)
+    return;
+  DPU_FOREACH(set, dpu, i) {
+    DPU_ASSERT(dpu_prepare_xfer(dpu, &staged->rest[(size_t)i * staged->stride]));
+  }
+  DPU_ASSERT(dpu_push_xfer_symbol(set, DPU_XFER_TO_DPU, mram_heap_sym, addr + staged->prefix * sizeof(uint32_t), (size_t)staged->stride * sizeof(uint32_t), DPU_XFER_DEFAULT));
+  free(staged->rest);
+  staged->rest = 0;
+}
+
+/**
+ * @fn dpu_populate_mram_array_u32
+ * @brief Copies the array of each DPU to the same MRAM address, with parallel transfers to the whole DPU set.
+ * @param addr the MRAM address of the arrays, from dpu_plan_mram_array_u32.
+ * @param srcs the host buffer of each DPU.
+ * @param lengths the number of elements of the array of each DPU.
+ */
+void dpu_populate_mram_array_u32(mram_addr_t addr, uint32_t **srcs, uint32_t *lengths) {
+  struct staged_arrays staged = dpu_stage_mram_array_u32(srcs, lengths);
+  dpu_push_mram_array_u32(addr, &staged);
+}
+
+// Returns the number of entries of the inbox of a frontier of length len.
+uint32_t inbox_capacity(uint32_t len) {
+  return (len + 1) / 2 / INBOX_RATIO;
+}
+
+/**
+ * @fn mram_bytes
+ * @brief Returns the MRAM used on each DPU by the BFS data (see plan_bfs_data) and the graph partitions of an
+ * algorithm (see the bfs_* functions).
+ * @param alg the BFS algorithm.
+ * @param num_rows the number of rows of each partition.
+ * @param num_cols the number of cols of each partition.
+ * @param max_edges the number of edges of the largest partition.
+ */
+uint64_t mram_bytes(enum Algorithm alg, uint32_t num_rows, uint32_t num_cols, uint64_t max_edges) {
+  uint32_t npw = alg == Hybrid ? 32 : nodes_per_word;
+  uint32_t len_cf = num_rows / npw;
+  uint32_t len_nf = num_cols / npw;
+  uint32_t len_nl = alg == TopDown ? num_rows : num_cols;
+  uint32_t entry_ints = sizeof(struct inbox_entry) / sizeof(uint32_t);
+
+  uint64_t bytes = 2 * mram_array_size(ROUND_UP_TO_MULTIPLE(len_nf, BLOCK_SIZE)) + mram_array_size(ROUND_UP_TO_MULTIPLE(len_cf, BLOCK_SIZE));
+  if (!multi_source)
+    bytes += mram_array_size(ROUND_UP_TO_MULTIPLE(len_nl, BLOCK_SIZE));
+  bytes += mram_array_size((1 + inbox_capacity(len_cf) + INBOX_BLOCK_ENTRIES) * entry_ints);
+  bytes += mram_array_size((1 + inbox_capacity(len_nf) + INBOX_BLOCK_ENTRIES) * entry_ints);
+  if (alg == TopDown || alg == Hybrid)
+    bytes += mram_array_size((uint64_t)num_rows + 1) + mram_array_size(max_edges);
+  if (alg == BottomUp || alg == Hybrid)
+    bytes += mram_array_size((uint64_t)num_cols + 1) + mram_array_size(max_edges);
+  if (alg == Edge)
+    bytes += 2 * mram_array_size(max_edges);
+  return bytes;
+}
+
+/**
+ * @fn plan_bfs_data
+ * @brief Plans the MRAM layout from the start of the heap with the BFS data, and broadcasts its lengths.
+ * The arrays are not populated, as bfs_roots resets them before each root.
+ * @param len_cf the length of curr_frontier of a DPU.
+ * @param len_nf the length of next_frontier of a DPU.
+ * @param len_nl the length of node_levels of a DPU.
+ */
+void plan_bfs_data(uint32_t len_cf, uint32_t len_nf, uint32_t len_nl) {
+  dpu_set_u32(set, "len_nf", len_nf);
+  dpu_set_u32(set, "len_cf", len_cf);
+
+  // Make sure arrays can be safely partitioned by NR_TASKLETS and BLOCK_SIZE.
+  uint32_t lcf = ROUND_UP_TO_MULTIPLE(len_cf, BLOCK_SIZE);
+  uint32_t lnf = ROUND_UP_TO_MULTIPLE(len_nf, BLOCK_SIZE);
+  uint32_t lnl = ROUND_UP_TO_MULTIPLE(len_nl, BLOCK_SIZE);
+
+  mram_plan_end = mram_heap_start;
+  vis_addr = dpu_plan_mram_array_u32("visited", lnf);
+  nf_addr = dpu_plan_mram_array_u32("next_frontier", lnf);
+  cf_addr = dpu_plan_mram_array_u32("curr_frontier", lcf);
+  if (!multi_source)
+    nl_addr = dpu_plan_mram_array_u32("node_levels", lnl);
+
+  // The inboxes start dense: the DPUs only mark them dense again after decoding them.
+  uint32_t entry_ints = sizeof(struct inbox_entry) / sizeof(uint32_t);
+  cf_inbox_addr = dpu_plan_mram_array_u32("cf_inbox", (1 + inbox_capacity(len_cf) + INBOX_BLOCK_ENTRIES) * entry_ints);
+  nf_inbox_addr = dpu_plan_mram_array_u32("nf_inbox", (1 + inbox_capacity(len_nf) + INBOX_BLOCK_ENTRIES) * entry_ints);
+  struct inbox_entry header = {.idx = INBOX_DENSE};
+  DPU_ASSERT(dpu_prepare_xfer(set, &header));
+  DPU_ASSERT(dpu_push_xfer_symbol(set, DPU_XFER_TO_DPU, mram_heap_sym, cf_inbox_addr, sizeof(struct inbox_entry), DPU_XFER_DEFAULT));
+  DPU_ASSERT(dpu_prepare_xfer(set, &header));
+  DPU_ASSERT(dpu_push_xfer_symbol(set, DPU_XFER_TO_DPU, mram_heap_sym, nf_inbox_addr, sizeof(struct inbox_entry), DPU_XFER_DEFAULT));
+}
+
+/**
+ * @fn push_frontier
+ * @brief Sends a slice of the frontier to a frontier array of each DPU. The slice is sent as the entries of the
+ * inbox of the array when few of its words are set in all DPUs (see INBOX_RATIO), and as a dense bitmap otherwise.
+ * @param frontier the frontier of the whole graph, with slice s at the node starts[s]. It must have len words past
+ * the start of the last slice.
+ * @param len the length of a slice.
+ * @param starts the node ranges of the slices (row_starts or col_starts).
+ * @param div DPU i receives slice i / div % mod.
+ * @param mod the number of slices.
+ * @param addr the MRAM address of the frontier array.
+ * @param inbox_addr the MRAM address of its inbox.
+ */
+void push_frontier(uint32_t *frontier, uint32_t len, uint32_t *starts, uint32_t div, uint32_t mod, mram_addr_t addr, mram_addr_t inbox_addr) {
+
+  // Encode the 8-byte words set in each slice, until a slice has too many.
+  uint32_t capacity = inbox_capacity(len);
+  uint32_t stride = 1 + capacity;
+  uint32_t max_count = 0;
+  struct inbox_entry *inboxes = capacity > 0 ? malloc((size_t)mod * stride * sizeof(struct inbox_entry)) : NULL;
+  for (uint32_t sl = 0; inboxes && sl < mod; ++sl) {
+    uint32_t *slice = &frontier[starts[sl] / nodes_per_word];
+    struct inbox_entry *inbox = &inboxes[(size_t)sl * stride];
+    uint32_t count = 0;
+    for (uint32_t w = 0; w < len; w += 2) {
+      uint32_t words[2] = {slice[w], w + 1 < len ? slice[w + 1] : 0};
+      if ((words[0] | words[1]) == 0)
+        continue;
+      if (count == capacity) {
+        free(inboxes);
+        inboxes = NULL;
+        break;
+      }
+      inbox[++count] = (struct inbox_entry){.idx = w / 2};
+      memcpy(&inbox[count].words, words, sizeof(uint64_t));
+    }
+    if (inboxes) {
+      inbox[0] = (struct inbox_entry){.idx = count};
+      max_count = count > max_count ? count : max_count;
+    }
+  }
+
+  uint32_t i = 0;
+  if (inboxes) {
+    DPU_FOREACH(set, dpu, i) {
+      DPU_ASSERT(dpu_prepare_xfer(dpu, &inboxes[(size_t)(i / div % mod) * stride]));
+    }
+    DPU_ASSERT(dpu_push_xfer_symbol(set, DPU_XFER_TO_DPU, mram_heap_sym, inbox_addr, (1 + max_count) * sizeof(struct inbox_entry), DPU_XFER_DEFAULT));
+    free(inboxes);
+  } else {
+    DPU_FOREACH(set, dpu, i) {
+      DPU_ASSERT(dpu_prepare_xfer(dpu, &frontier[starts[i / div % mod] / nodes_per_word]));
+    }
+    DPU_ASSERT(dpu_push_xfer_symbol(set, DPU_XFER_TO_DPU, mram_heap_sym, addr, ROUND_UP_TO_MULTIPLE(len * sizeof(uint32_t), 8), DPU_XFER_DEFAULT));
+  }
+}
+
+/**
+ * @fn populate_partitions
+ * @brief Plans an array of the graph partitions in MRAM, sized to the largest partition, and populates it.
+ * @param symbol_name the name of the DPU symbol of the pointer to the array.
+ * @param srcs the array of each partition.
+ * @param lengths the number of elements of the array of each partition.
+ */
+void populate_partitions(const char *symbol_name, uint32_t **srcs, uint32_t *lengths) {
+  uint32_t max_length = 0;
+  for (uint32_t i = 0; i < num_dpu; ++i)
+    max_length = lengths[i] > max_length ? lengths[i] : max_length;
+  dpu_populate_mram_array_u32(dpu_plan_mram_array_u32(symbol_name, max_length), srcs, lengths);
+}
+
+// Streaming of the edges of top-down BFS, when they do not fit in MRAM. The rows of the partitions are split into
+// segments, with the same rows on all DPUs, whose edges fit in a window of MRAM. A level runs in one launch per
+// segment with nodes in the current frontier of a DPU, the edges of the segment being sent before its launch.
+// The rows of a word of curr_frontier whose edges do not fit in the window on a DPU are split into several
+// segments, each with the next window of their edges.
+#define SEG_FIRST 1 // First launch of a level.
+#define SEG_LAST 2  // Last launch of a level.
+struct segment {
+  uint32_t from;     // First word of curr_frontier of the segment.
+  uint32_t to;       // Word of curr_frontier past the segment.
+  uint32_t base;     // Index of the first edge of the segment in the partition of the DPU.
+  uint32_t end;      // Index of the edge past the segment in the partition of the DPU.
+  uint32_t flags;    // SEG_FIRST and SEG_LAST.
+  uint32_t reserved; // Unused.
+};
+struct segment_plan {
+  uint32_t from; // First word of curr_frontier of the segment.
+  uint32_t to;   // Word of curr_frontier past the segment.
+  uint32_t part; // Window of the edges of the rows taken by the segment, if they do not fit in one.
+};
+struct {
+  uint32_t num_segments;       // Number of segments, or 0 if the edges are not streamed.
+  struct segment_plan *plan;   // Rows of each segment.
+  uint32_t window;             // Number of edges that fit in the window.
+  bool *active;                // Whether each segment has nodes in the current frontier of a DPU.
+  struct CSR *csr;       // Partitions of the DPUs.
+  mram_addr_t addr;      // MRAM address of the window of the edges.
+} streaming;
+
+// Adds a segment to the plan.
+static void add_segment(uint32_t *capacity, uint32_t from, uint32_t to, uint32_t part) {
+  if (streaming.num_segments == *capacity) {
+    *capacity *= 2;
+    streaming.plan = realloc(streaming.plan, *capacity * sizeof(struct segment_plan));
+  }
+  streaming.plan[streaming.num_segments++] = (struct segment_plan){.from = from, .to = to, .part = part};
+}
+
+/**
+ * @fn plan_segments
+ * @brief Splits the rows of the partitions into segments of whole words of curr_frontier, whose edges fit in the
+ * window of the edges on every DPU. A word whose edges do not fit on a DPU is split into as many segments as it
+ * needs windows there.
+ * @param csr the partitions.
+ * @param len_cf the length of curr_frontier of a DPU.
+ * @param window the number of edges that fit in the window.
+ */
+void plan_segments(struct CSR *csr, uint32_t len_cf, uint32_t window) {
+  uint32_t capacity = len_cf + 1;
+  streaming.plan = malloc(capacity * sizeof(struct segment_plan));
+  streaming.csr = csr;
+  streaming.window = window;
+  streaming.num_segments = 0;
+
+  uint32_t from = 0;
+  for (uint32_t w = 0; w < len_cf; ++w) {
+    // Close the segment before word w if the edges up to w do not fit on a DPU.
+    bool fits = true;
+    uint32_t parts = 1;
+    for (uint32_t i = 0; i < num_dpu; ++i) {
+      uint32_t *ptrs = csr[i].row_ptrs;
+      uint32_t word_edges = ptrs[(w + 1) * 32] - ptrs[w * 32];
+      fits = fits && ptrs[(w + 1) * 32] - ptrs[from * 32] <= window;
+      parts = (word_edges + window - 1) / window > parts ? (word_edges + window - 1) / window : parts;
+    }
+    if (!fits && from < w)
+      add_segment(&capacity, from, w, 0);
+    if (!fits)
+      from = w;
+
+    // Split the word if its edges alone do not fit.
+    if (parts > 1) {
+      for (uint32_t part = 0; part < parts; ++part)
+        add_segment(&capacity, w, w + 1, part);
+      from = w + 1;
+    }
+  }
+  if (from < len_cf)
+    add_segment(&capacity, from, len_cf, 0);
+  streaming.active = calloc(streaming.num_segments, sizeof(bool));
+}
+
+/**
+ * @fn activate_segments
+ * @brief Marks the segments with nodes in curr_frontier, on the DPUs that receive the frontier in push_frontier.
+ * Does nothing if the edges are not streamed.
+ * @param frontier the frontier of the whole graph, with slice s at the node starts[s].
+ * @param starts the node ranges of the slices (row_starts).
+ * @param mod the number of slices.
+ */
+void activate_segments(uint32_t *frontier, uint32_t *starts, uint32_t mod) {
+  for (uint32_t s = 0; s < streaming.num_segments; ++s) {
+    streaming.active[s] = false;
+    for (uint32_t sl = 0; sl < mod && !streaming.active[s]; ++sl) {
+      uint32_t *slice = &frontier[starts[sl] / 32];
+      for (uint32_t w = streaming.plan[s].from; w < streaming.plan[s].to && !streaming.active[s]; ++w)
+        streaming.active[s] = slice[w] != 0;
+    }
+  }
+}
+
+// Returns the first active segment from segment s, or num_segments if there is none.
+static inline uint32_t next_segment(uint32_t s) {
+  while (s < streaming.num_segments && !streaming.active[s])
+    s++;
+  return s;
+}
+
+/**
+ * @fn stage_segment
+ * @brief Stages the edges of a segment of each DPU, and its segment descriptor.
+ * @param s the segment.
+ * @param srcs the edges of the segment of each DPU, set.
+ * @param lengths the number of edges of the segment of each DPU, set.
+ * @param segs the descriptor of the segment of each DPU, set, without flags.
+ * @return the staged edges.
+ */
+struct staged_arrays stage_segment(uint32_t s, uint32_t **srcs, uint32_t *lengths, struct segment *segs) {
+  struct segment_plan seg = streaming.plan[s];
+  for (uint32_t i = 0; i < num_dpu; ++i) {
+    uint32_t *ptrs = streaming.csr[i].row_ptrs;
+    uint32_t end = ptrs[seg.to * 32];
+    uint32_t base = ptrs[seg.from * 32] + (uint64_t)seg.part * streaming.window < end ? ptrs[seg.from * 32] + seg.part * streaming.window : end;
+    end = end - base > streaming.window ? base + streaming.window : end;
+    segs[i] = (struct segment){.from = seg.from, .to = seg.to, .base = base, .end = end};
+    srcs[i] = &streaming.csr[i].col_idxs[base];
+    lengths[i] = end - base;
+  }
+  return dpu_stage_mram_array_u32(srcs, lengths);
+}
+
+/**
+ * @fn launch_level
+ * @brief Runs a level on the DPUs. If the edges are streamed, the level runs in one launch per active segment: the
+ * DPUs run asynchronously while the next segment is staged, and its edges are sent once they are done.
+ */
+void launch_level(void) {
+  if (streaming.num_segments == 0) {
+    DPU_ASSERT(dpu_launch(set, DPU_SYNCHRONOUS));
+    return;
+  }
+
+  // Double buffers: the segment that is sent, and the next one.
+  uint32_t *srcs[2][num_dpu], lengths[2][num_dpu];
+  struct segment segs[2][num_dpu];
+  struct staged_arrays staged[2];
+
+  // A level with no active segment still needs a launch, to fold next_frontier and advance the level.
+  uint32_t s = next_segment(0);
+  uint32_t b = 0;
+  if (s == streaming.num_segments) {
+    struct segment empty = {.from = 0, .to = 0, .base = 0, .end = 0, .flags = SEG_FIRST | SEG_LAST};
+    DPU_ASSERT(dpu_copy_to(set, "segment", 0, &empty, sizeof(struct segment)));
+    DPU_ASSERT(dpu_launch(set, DPU_SYNCHRONOUS));
+    return;
+  }
+  staged[b] = stage_segment(s, srcs[b], lengths[b], segs[b]);
+
+  for (bool first = true; s < streaming.num_segments; first = false) {
+    uint32_t next = next_segment(s + 1);
+
+    // Send the segment.
+    uint32_t i = 0;
+    DPU_FOREACH(set, dpu, i) {
+      segs[b][i].flags = (first ? SEG_FIRST : 0) | (next == streaming.num_segments ? SEG_LAST : 0);
+      DPU_ASSERT(dpu_prepare_xfer(dpu, &segs[b][i]));
+    }
+    DPU_ASSERT(dpu_push_xfer(set, DPU_XFER_TO_DPU, "segment", 0, sizeof(struct segment), DPU_XFER_DEFAULT));
+    dpu_push_mram_array_u32(streaming.addr, &staged[b]);
+
+    // Stage the next segment while the DPUs run.
+    DPU_ASSERT(dpu_launch(set, DPU_ASYNCHRONOUS));
+    if (next < streaming.num_segments)
+      staged[1 - b] = stage_segment(next, srcs[1 - b], lengths[1 - b], segs[1 - b]);
+    DPU_ASSERT(dpu_sync(set));
+
+    s = next;
+    b = 1 - b;
+  }
+}
+
+/**
+ * @fn stop_streaming
+ * @brief Frees the segments, and resets the segment of the DPUs to all the edges.
+ */
+void stop_streaming(void) {
+  if (streaming.num_segments == 0)
+    return;
+  struct segment all = {.from = 0, .to = UINT32_MAX, .base = 0, .end = UINT32_MAX, .flags = SEG_FIRST | SEG_LAST};
+  DPU_ASSERT(dpu_copy_to(set, "segment", 0, &all, sizeof(struct segment)));
+  free(streaming.plan);
+  free(streaming.active);
+  streaming.num_segments = 0;
+}
+
 // Finds the two nearest factors of n.
 void nearest_factors(uint32_t n, uint32_t *first, uint32_t *second) {
   uint32_t f = (uint32_t)sqrt(n);
@@ -208,14 +786,33 @@ void nearest_factors(uint32_t n, uint32_t *first, uint32_t *second) {
   *second = n / f;
 }
 
+// Gets the grid of a 2D partitioning of n DPUs: the chosen grid, or the two nearest factors of n.
+void grid_2d(uint32_t n, uint32_t *row_div, uint32_t *col_div) {
+  if (grid_row_div * grid_col_div == n) {
+    *row_div = grid_row_div;
+    *col_div = grid_col_div;
+  } else
+    nearest_factors(n, row_div, col_div);
+}
+
 // Parse CLI args and options.
-void parse_args(int argc, char **argv, uint32_t *num_dpu, enum Algorithm *alg, enum Partition *prt, char **bin_path, char **file, char **out_file) {
+void parse_args(int argc, char **argv, uint32_t *num_dpu, enum Algorithm *alg, enum Partition *prt, char **file, char **out_file, uint32_t *root, char **roots_file, char **cache_file) {
+  static struct option long_options[] = {
+      {"save-cache", required_argument, NULL, 'S'},
+      {"reorder", required_argument, NULL, 'O'},
+      {"calibration", required_argument, NULL, 'C'},
+      {"stream-load", no_argument, NULL, 'L'},
+      {NULL, 0, NULL, 0}};
   bool is_prt_set = false;
   int c;
   opterr = 0;
-  while ((c = getopt(argc, argv, "n:a:p:o:")) != -1)
+  while ((c = getopt_long(argc, argv, "n:a:p:bO:o:r:R:mt:S:C:L", long_options, NULL)) != -1)
     switch (c) {
     case 'n':
+      if (strcmp(optarg, "auto") == 0) {
+        auto_dpu = true;
+        break;
+      }
       *num_dpu = atoi(optarg);
       if (num_dpu == 0 || *num_dpu % 8 != 0) {
         PRINT_ERROR("Number of DPUs must be a multiple of 8.");
@@ -223,28 +820,40 @@ void parse_args(int argc, char **argv, uint32_t *num_dpu, enum Algorithm *alg, e
       }
       break;
     case 'a':
+      auto_alg = false;
       if (strcmp(optarg, "top") == 0) {
         PRINT_INFO("Algorithm: Vertex-centric Top-Down BFS.");
-        *bin_path = "bin/top-down-dma";
         *alg = TopDown;
         if (!is_prt_set)
           *prt = Row;
       } else if (strcmp(optarg, "bot") == 0) {
         PRINT_INFO("Algorithm: Vertex-centric Bottom-Up BFS.");
-        *bin_path = "bin/bottom-up-dma";
         *alg = BottomUp;
         if (!is_prt_set)
           *prt = Col;
       } else if (strcmp(optarg, "edge") == 0) {
         PRINT_INFO("Algorithm: Edge-centric BFS.");
-        *bin_path = "bin/edge-dma";
         *alg = Edge;
         if (!is_prt_set)
           *prt = _2D;
+      } else if (strcmp(optarg, "hybrid") == 0) {
+        PRINT_INFO("Algorithm: Direction-optimizing (Top-Down and Bottom-Up) BFS.");
+        *alg = Hybrid;
+        if (!is_prt_set)
+          *prt = _2D;
+      } else if (strcmp(optarg, "cpu") == 0) {
+        PRINT_INFO("Algorithm: Direction-optimizing BFS on the host CPU.");
+        *alg = Cpu;
+      } else if (strcmp(optarg, "auto") == 0) {
+        auto_alg = true;
+        if (!is_prt_set)
+          auto_prt = true;
       } else {
-        PRINT_ERROR("Incorrect -a argument. Supported algorithms: top | bot | edge");
+        PRINT_ERROR("Incorrect -a argument. Supported algorithms: top | bot | edge | hybrid | cpu | auto");
         exit(1);
       }
+      if (!auto_alg && !is_prt_set)
+        auto_prt = false;
       break;
     case 'p':
       if (strcmp(optarg, "row") == 0) {
@@ -256,18 +865,60 @@ void parse_args(int argc, char **argv, uint32_t *num_dpu, enum Algorithm *alg, e
       } else if (strcmp(optarg, "2d") == 0) {
         PRINT_INFO("Partitioning: 2D (both source-nodes and destination-nodes).");
         *prt = _2D;
-      } else {
-        PRINT_ERROR("Incorrect -p argument. Supported partitioning: row | col | 2d");
+      } else if (strcmp(optarg, "auto") != 0) {
+        PRINT_ERROR("Incorrect -p argument. Supported partitioning: row | col | 2d | auto");
         exit(1);
       }
+      auto_prt = strcmp(optarg, "auto") == 0;
       is_prt_set = true;
       break;
+    case 'b':
+      PRINT_INFO("Partitions balanced by edges.");
+      balanced = true;
+      break;
+    case 'O':
+      if (strcmp(optarg, "degree") == 0)
+        order = OrderDegree;
+      else if (strcmp(optarg, "rcm") == 0)
+        order = OrderRCM;
+      else if (strcmp(optarg, "hub") == 0)
+        order = OrderHub;
+      else {
+        PRINT_ERROR("Incorrect -O argument. Supported orders: degree | rcm | hub");
+        exit(1);
+      }
+      break;
     case 'o':
       *out_file = optarg;
       break;
+    case 'r':
+      *root = atoi(optarg);
+      break;
+    case 'R':
+      *roots_file = optarg;
+      break;
+    case 'm':
+      multi_source = true;
+      break;
+    case 'S':
+      *cache_file = optarg;
+      break;
+    case 'C':
+      calibration_file = optarg;
+      break;
+    case 'L':
+      stream_load = true;
+      break;
+    case 't':
+      num_threads = atoi(optarg);
+      if (num_threads == 0) {
+        PRINT_ERROR("Number of threads must be positive.");
+        exit(1);
+      }
+      break;
     case '?':
     default:
-      PRINT_ERROR("Bad args. Usage: -n <num_dpu> -a <top|bot|edge> -p <row|col|2d> -o <output_file>");
+      PRINT_ERROR("Bad args. Usage: -n <num_dpu|auto> -a <top|bot|edge|hybrid|cpu|auto> -p <row|col|2d|auto> -b -O <degree|rcm|hub> -o <output_file> -r <root> -R <roots_file> -m -t <num_threads> -S <cache_file> -C <calibration_file> -L");
       exit(1);
     }
 
@@ -283,37 +934,177 @@ void parse_args(int argc, char **argv, uint32_t *num_dpu, enum Algorithm *alg, e
 
   if (*out_file == NULL)
     *out_file = "/dev/null";
-}
 
-// Load coo-formated file into memory.
-// Pads the number of nodes to guarantee divisibility by n and further divisibility by 32.
-struct COO load_coo(char *file, uint32_t n) {
+  if (multi_source) {
+    PRINT_INFO("Multi-source BFS of up to %u roots at once.", MS_SOURCES);
+    nodes_per_word = 1;
+    if ((*alg == Hybrid || *alg == Cpu) && !auto_alg) {
+      PRINT_ERROR("Multi-source BFS supports the top | bot | edge algorithms only.");
+      exit(1);
+    }
+  }
 
-  if (access(file, F_OK) == -1) {
-    PRINT_ERROR("Could not find file %s.", file);
+  // The host BFS runs on the whole graph, loaded as a single partition.
+  if (*alg == Cpu && !auto_alg) {
+    *num_dpu = 1;
+    *prt = Row;
+    auto_dpu = false;
+    auto_prt = false;
+  }
+
+  if (stream_load && (auto_alg || auto_prt || auto_dpu || order != OrderNone)) {
+    PRINT_ERROR("Streamed loading (-L) does not hold the whole graph, which auto options and reordering need.");
     exit(1);
   }
+}
 
-  PRINT_INFO("Loading adjacency list formated graph from %s.", file);
-  struct COO coo;
+// Returns the DPU program of a BFS algorithm.
+char *dpu_binary(enum Algorithm alg) {
+  static char *binaries[] = {"bin/top-down-dma", "bin/bottom-up-dma", "bin/edge-dma", "bin/hybrid-dma"};
+  static char *ms_binaries[] = {"bin/ms-top-down-dma", "bin/ms-bottom-up-dma", "bin/ms-edge-dma"};
+  return multi_source ? ms_binaries[alg] : binaries[alg];
+}
 
-  // Initialize COO from file.
-  uint32_t num_nodes = 0;
-  uint32_t num_edges = 0;
+// Loads BFS roots from a file with one root per line.
+uint32_t *load_roots(char *file, uint32_t *len) {
 
   FILE *fp = fopen(file, "r");
-  int match = fscanf(fp, "%u %u", &num_nodes, &num_edges);
-  if (match != 2) {
-    PRINT_ERROR("Could not properly read Adjacency list file. First line must be of the form: NUM_NODES NUM_EDGES");
+  if (fp == NULL) {
+    PRINT_ERROR("Could not find file %s.", file);
     exit(1);
   }
 
-  coo.num_edges = num_edges;
-  coo.row_idxs = malloc(num_edges * sizeof(uint32_t));
-  coo.col_idxs = malloc(num_edges * sizeof(uint32_t));
+  uint32_t capacity = 64;
+  uint32_t *ids = malloc(capacity * sizeof(uint32_t));
+  uint32_t root;
+  *len = 0;
+  while (fscanf(fp, "%u", &root) == 1) {
+    if (*len == capacity) {
+      capacity *= 2;
+      ids = realloc(ids, capacity * sizeof(uint32_t));
+    }
+    ids[(*len)++] = root;
+  }
+  if (!feof(fp) || *len == 0) {
+    PRINT_ERROR("Could not properly read roots file %s. Lines must be of the form: ROOT", file);
+    exit(1);
+  }
+  fclose(fp);
+
+  PRINT_INFO("Loaded %u BFS roots from %s.", *len, file);
+  return ids;
+}
+
+// Skips spaces and tabs (and carriage returns) of a line.
+static inline const char *skip_blanks(const char *p, const char *end) {
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+    ++p;
+  return p;
+}
+
+// Parses an unsigned integer at p. Returns the first char after it, or 0 if there is no integer at p.
+static inline const char *parse_u32(const char *p, const char *end, uint32_t *val) {
+  const char *start = p;
+  uint32_t v = 0;
+  while (p < end && (uint8_t)(*p - '0') < 10)
+    v = v * 10 + (uint32_t)(*p++ - '0');
+  *val = v;
+  return p == start ? 0 : p;
+}
+
+// Parses a 64-bit unsigned integer at p, like parse_u32.
+static inline const char *parse_u64(const char *p, const char *end, uint64_t *val) {
+  const char *start = p;
+  uint64_t v = 0;
+  while (p < end && (uint8_t)(*p - '0') < 10)
+    v = v * 10 + (uint64_t)(*p++ - '0');
+  *val = v;
+  return p == start ? 0 : p;
+}
+
+// Returns the end of the line starting at p (its newline, or end).
+static inline const char *line_end(const char *p, const char *end) {
+  const char *nl = memchr(p, '\n', end - p);
+  return nl ? nl : end;
+}
+
+// Returns whether the line [p, eol) only has whitespace. Such lines are skipped, as fscanf would.
+static inline bool is_blank_line(const char *p, const char *eol) {
+  return skip_blanks(p, eol) == eol;
+}
+
+// Parses a line of the form: ROW_IDX COL_IDX [ignored...]. Returns false if the line is malformed.
+static inline bool parse_edge(const char *p, const char *eol, uint32_t *row_idx, uint32_t *col_idx) {
+  p = parse_u32(skip_blanks(p, eol), eol, row_idx);
+  if (p == 0 || p == eol || (*p != ' ' && *p != '\t'))
+    return false;
+  return parse_u32(skip_blanks(p, eol), eol, col_idx) != 0;
+}
+
+// Parses the first line of a datafile: NUM_NODES NUM_EDGES. Returns false if the line is malformed.
+static inline bool parse_header(const char *p, const char *eol, uint32_t *num_nodes, uint64_t *num_edges) {
+  p = parse_u32(skip_blanks(p, eol), eol, num_nodes);
+  if (p == 0 || p == eol || (*p != ' ' && *p != '\t'))
+    return false;
+  return parse_u64(skip_blanks(p, eol), eol, num_edges) != 0;
+}
+
+// Chunk of the edge list parsed by a loader thread.
+struct load_chunk {
+  const char *begin;  // First char of the chunk (start of a line).
+  const char *end;    // One past the last char of the chunk (start of a line, or end of file).
+  uint64_t num_lines; // Number of non-blank lines in the chunk.
+  uint64_t first;     // Index of the first edge of the chunk.
+  uint64_t num_edges; // Total number of edges to read.
+  uint64_t bad;       // Index of the first malformed edge of the chunk, or UINT64_MAX.
+  struct COO *coo;    // Destination of the edges.
+};
+
+// Counts the non-blank lines of a chunk.
+void *count_lines(void *arg) {
+  struct load_chunk *chunk = arg;
+  uint64_t num_lines = 0;
+  for (const char *p = chunk->begin; p < chunk->end;) {
+    const char *eol = line_end(p, chunk->end);
+    if (!is_blank_line(p, eol))
+      num_lines++;
+    p = eol + 1;
+  }
+  chunk->num_lines = num_lines;
+  return NULL;
+}
+
+// Parses edge i of a chunk, from the line at *p, and moves *p past it. Returns false at the end of the chunk or of the
+// edges, and at a malformed line, whose index is kept in chunk->bad.
+static inline bool next_edge(struct load_chunk *chunk, const char **p, uint64_t i, uint32_t *row_idx, uint32_t *col_idx) {
+  while (*p < chunk->end && i < chunk->num_edges) {
+    const char *line = *p;
+    const char *eol = line_end(line, chunk->end);
+    *p = eol + 1;
+    if (is_blank_line(line, eol))
+      continue;
+    if (!parse_edge(line, eol, row_idx, col_idx)) {
+      chunk->bad = i;
+      return false;
+    }
+    return true;
+  }
+  return false;
+}
+
+// Parses the edges of a chunk into the COO, starting at edge index chunk->first.
+void *parse_lines(void *arg) {
+  struct load_chunk *chunk = arg;
+  uint32_t *row_idxs = chunk->coo->row_idxs;
+  uint32_t *col_idxs = chunk->coo->col_idxs;
+  const char *p = chunk->begin;
+  for (uint64_t i = chunk->first; next_edge(chunk, &p, i, &row_idxs[i], &col_idxs[i]); ++i)
+    ;
+  return NULL;
+}
 
-  // Pad the number of nodes to guarantee divisibility by n and then by 32.
-  uint32_t old = num_nodes;
+// Returns the number of nodes padded to guarantee divisibility by n and then by 32.
+uint32_t padded_nodes(uint32_t num_nodes, uint32_t n) {
   if (num_nodes % n != 0)
     num_nodes += n - num_nodes % n;
 
@@ -322,208 +1113,874 @@ struct COO load_coo(char *file, uint32_t n) {
     chunk_size += 32 - chunk_size % 32;
     num_nodes = chunk_size * n;
   }
+  return num_nodes;
+}
 
-  uint32_t padding = num_nodes - old;
+// Pads the number of nodes of a COO matrix to guarantee divisibility by n and then by 32. Returns the nodes added.
+uint32_t pad_nodes(struct COO *coo, uint32_t n) {
+  uint32_t num_nodes = padded_nodes(coo->num_rows, n);
+  uint32_t padding = num_nodes - coo->num_rows;
   if (padding != 0)
     PRINT_WARNING("Padding number of nodes with %u extra nodes.", padding);
+  coo->num_rows = num_nodes;
+  coo->num_cols = num_nodes;
+  return padding;
+}
 
-  coo.num_rows = num_nodes;
-  coo.num_cols = num_nodes;
-
-  // Read nonzeros.
-  PRINT_INFO("%u nodes, %u edges.", num_nodes, num_edges);
+// Datafile mapped in memory, with its edges split into a chunk of lines per thread (see map_datafile).
+struct datafile {
+  int fd;
+  const char *data;          // Mapped file, or NULL if it is empty.
+  size_t size;               // Size of the file.
+  uint32_t num_nodes;        // Number of nodes, from the header.
+  uint64_t num_edges;        // Number of edges, from the header.
+  uint64_t num_lines;        // Number of non-blank lines after the header.
+  struct load_chunk *chunks; // Chunk of each of the num_threads threads.
+};
 
-  uint32_t row_idx, col_idx;
-  match = fscanf(fp, "%u %u%*[^\n]\n", &row_idx, &col_idx); // Read first 2 integers of file.
-  if (match != 2) {
-    PRINT_ERROR("Could not properly read line %u. Lines must be of the form: ROW_IDX COL_IDX", 1);
+// Maps a datafile and reads its header. Its edges are split into line-aligned chunks, and a first pass counts the lines
+// of each chunk in parallel, so that each thread knows the index of the first edge of its chunk.
+struct datafile map_datafile(char *file) {
+  struct datafile df = {.fd = open(file, O_RDONLY)};
+  if (df.fd == -1) {
+    PRINT_ERROR("Could not find file %s.", file);
     exit(1);
   }
 
-  uint32_t row_offset = row_idx; // Guarantee 0-indexed COO.
-  coo.row_idxs[0] = row_idx - row_offset;
-  coo.col_idxs[0] = col_idx - row_offset;
+  PRINT_INFO("Loading adjacency list formated graph from %s.", file);
 
-  for (uint32_t i = 1; i < num_edges; ++i) {
-    match = fscanf(fp, "%u %u%*[^\n]\n", &row_idx, &col_idx);
-    if (match != 2) {
-      PRINT_ERROR("Could not properly read line %u. Lines must be of the form: ROW_IDX COL_IDX", i + 1);
-      exit(1);
-    }
-    coo.row_idxs[i] = row_idx - row_offset;
-    coo.col_idxs[i] = col_idx - row_offset;
+  struct stat st;
+  fstat(df.fd, &st);
+  df.size = st.st_size;
+  df.data = df.size ? mmap(NULL, df.size, PROT_READ, MAP_PRIVATE, df.fd, 0) : NULL;
+  if (df.data == MAP_FAILED) {
+    PRINT_ERROR("Could not map file %s.", file);
+    exit(1);
   }
-  fclose(fp);
+  const char *end = df.data + df.size;
 
-  return coo;
+  const char *p = df.data;
+  while (p < end && isspace((unsigned char)*p))
+    ++p;
+  const char *eol = line_end(p, end);
+  if (p == end || !parse_header(p, eol, &df.num_nodes, &df.num_edges)) {
+    PRINT_ERROR("Could not properly read Adjacency list file. First line must be of the form: NUM_NODES NUM_EDGES");
+    exit(1);
+  }
+  p = eol < end ? eol + 1 : end;
+
+  // Split the edge list into chunks that start at the beginning of a line.
+  df.chunks = malloc(num_threads * sizeof(struct load_chunk));
+  for (uint32_t t = 0; t < num_threads; ++t) {
+    const char *begin = p + (end - p) * t / num_threads;
+    if (t > 0 && begin > p && begin[-1] != '\n')
+      begin = begin < end ? line_end(begin, end) + 1 : end;
+    if (begin > end)
+      begin = end;
+    df.chunks[t] = (struct load_chunk){.begin = begin, .num_edges = df.num_edges, .bad = UINT64_MAX};
+    if (t > 0)
+      df.chunks[t - 1].end = begin;
+  }
+  df.chunks[num_threads - 1].end = end;
+
+  // Count the lines of each chunk, to start each chunk at the edge index of its first line.
+  pthread_t threads[num_threads];
+  for (uint32_t t = 0; t < num_threads; ++t)
+    pthread_create(&threads[t], NULL, count_lines, &df.chunks[t]);
+  for (uint32_t t = 0; t < num_threads; ++t)
+    pthread_join(threads[t], NULL);
+
+  for (uint32_t t = 0; t < num_threads; ++t) {
+    df.chunks[t].first = df.num_lines;
+    df.num_lines += df.chunks[t].num_lines;
+  }
+  return df;
 }
 
-// Partition COO matrix into n COO matrices by col, or by row, or both (2D). Assumes n is even.
-struct COO *partition_coo(struct COO coo, uint32_t n, enum Partition prt) {
+// Reports the first malformed or missing line of a datafile found by a pass over its chunks, and exits.
+void check_lines(struct datafile *df) {
+  uint64_t bad = df->num_lines < df->num_edges ? df->num_lines : UINT64_MAX;
+  for (uint32_t t = 0; t < num_threads; ++t)
+    if (df->chunks[t].bad < bad)
+      bad = df->chunks[t].bad;
+  if (bad != UINT64_MAX) {
+    PRINT_ERROR("Could not properly read line %lu. Lines must be of the form: ROW_IDX COL_IDX", bad + 1);
+    exit(1);
+  }
+}
 
-  PRINT_INFO("Partitioning adjacency matrix into %u parts.", n);
+// Unmaps a datafile.
+void unmap_datafile(struct datafile *df) {
+  if (df->size)
+    munmap((void *)df->data, df->size);
+  close(df->fd);
+  free(df->chunks);
+}
 
-  struct COO *prts = malloc(n * sizeof(struct COO));
+// Returns the row of the first edge of a datafile, which node IDs are offset by to be 0-indexed.
+uint32_t first_node(struct datafile *df) {
+  struct load_chunk all = {.begin = df->chunks[0].begin, .end = df->chunks[num_threads - 1].end, .num_edges = 1};
+  const char *p = all.begin;
+  uint32_t row_idx, col_idx;
+  return next_edge(&all, &p, 0, &row_idx, &col_idx) ? row_idx : 0;
+}
 
-  // Initialize num_edges.
-  for (uint32_t i = 0; i < n; ++i)
-    prts[i].num_edges = 0;
+// Load coo-formated file into memory.
+// Pads the number of nodes to guarantee divisibility by n and further divisibility by 32.
+// The file is memory-mapped and split into line-aligned chunks, parsed in parallel by num_threads threads
+// (see map_datafile).
+struct COO load_coo(char *file, uint32_t n, uint32_t *padding) {
 
-  uint32_t num_rows = coo.num_rows;
-  uint32_t num_cols = coo.num_cols;
-  uint32_t row_div = 1;
-  uint32_t col_div = 1;
-  bool offset_row = false;
-  bool offset_col = false;
+  struct datafile df = map_datafile(file);
+  uint64_t num_edges = df.num_edges;
 
-  // Determine num_rows, num_cols, and num_edges per partition.
-  switch (prt) {
-  case Row:
-    offset_row = true;
-    row_div = n;
-    num_rows /= row_div;
-    for (uint32_t i = 0; i < coo.num_edges; ++i) {
-      uint32_t row_idx = coo.row_idxs[i];
-      prts[row_idx / num_rows].num_edges++;
-    }
-    break;
+  // Initialize COO from file.
+  struct COO coo;
+  coo.num_edges = num_edges;
+  coo.row_idxs = malloc(num_edges * sizeof(uint32_t));
+  coo.col_idxs = malloc(num_edges * sizeof(uint32_t));
 
-  case Col:
-    offset_col = true;
-    col_div = n;
-    num_cols /= col_div;
-    for (uint32_t i = 0; i < coo.num_edges; ++i) {
-      uint32_t col_idx = coo.col_idxs[i];
-      prts[col_idx / num_cols].num_edges++;
+  coo.num_rows = df.num_nodes;
+  coo.num_cols = df.num_nodes;
+  *padding = pad_nodes(&coo, n);
+
+  // Read nonzeros.
+  PRINT_INFO("%u nodes, %lu edges.", coo.num_rows, num_edges);
+
+  pthread_t threads[num_threads];
+  for (uint32_t t = 0; t < num_threads; ++t) {
+    df.chunks[t].coo = &coo;
+    pthread_create(&threads[t], NULL, parse_lines, &df.chunks[t]);
+  }
+  for (uint32_t t = 0; t < num_threads; ++t)
+    pthread_join(threads[t], NULL);
+  check_lines(&df);
+  unmap_datafile(&df);
+
+  // Guarantee 0-indexed COO.
+  uint32_t row_offset = num_edges ? coo.row_idxs[0] : 0;
+  if (row_offset != 0)
+    for (uint64_t i = 0; i < num_edges; ++i) {
+      coo.row_idxs[i] -= row_offset;
+      coo.col_idxs[i] -= row_offset;
     }
-    break;
 
-  case _2D:
-    offset_row = true;
-    offset_col = true;
+  return coo;
+}
+
+// Returns the partition of an edge, from the range of each block of 32 rows and cols, with col_div partitions per row.
+static inline uint32_t edge_partition(uint32_t row_idx, uint32_t col_idx, uint32_t *row_ranges, uint32_t *col_ranges, uint32_t col_div) {
+  return row_ranges[row_idx / 32] * col_div + col_ranges[col_idx / 32];
+}
+
+// Range of edges binned by a partitioner thread.
+struct partition_chunk {
+  struct COO *coo;      // Whole COO matrix.
+  struct COO *prts;     // COO partitions, pointing into the arena.
+  uint64_t from;        // First edge of the range.
+  uint64_t to;          // One past the last edge of the range.
+  uint32_t col_div;     // Number of partitions per row of the adjacency matrix.
+  uint32_t *row_ranges; // Row range of each block of 32 rows (see row_starts).
+  uint32_t *col_ranges; // Col range of each block of 32 cols (see col_starts).
+  uint64_t *counts;     // Number of edges of the range in each partition, then where the range starts in each partition.
+};
+
+// Counts the edges of a range in each block of 32 rows and of 32 cols, as the row and col counts of chunk->counts.
+void *count_blocks(void *arg) {
+  struct partition_chunk *chunk = arg;
+  uint64_t *row_counts = chunk->counts;
+  uint64_t *col_counts = &chunk->counts[chunk->coo->num_rows / 32];
+  for (uint64_t i = chunk->from; i < chunk->to; ++i) {
+    __atomic_fetch_add(&row_counts[chunk->coo->row_idxs[i] / 32], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&col_counts[chunk->coo->col_idxs[i] / 32], 1, __ATOMIC_RELAXED);
+  }
+  return NULL;
+}
+
+// Counts the edges of a range that fall in each partition.
+void *count_partitions(void *arg) {
+  struct partition_chunk *chunk = arg;
+  for (uint64_t i = chunk->from; i < chunk->to; ++i)
+    chunk->counts[edge_partition(chunk->coo->row_idxs[i], chunk->coo->col_idxs[i], chunk->row_ranges, chunk->col_ranges, chunk->col_div)]++;
+  return NULL;
+}
+
+// Bins the edges of a range at their place in the partitions, offsetting them to the partitions' nodes.
+void *scatter_partitions(void *arg) {
+  struct partition_chunk *chunk = arg;
+  for (uint64_t i = chunk->from; i < chunk->to; ++i) {
+    uint32_t row_idx = chunk->coo->row_idxs[i];
+    uint32_t col_idx = chunk->coo->col_idxs[i];
+    uint32_t p = edge_partition(row_idx, col_idx, chunk->row_ranges, chunk->col_ranges, chunk->col_div);
+    uint64_t idx = chunk->counts[p]++;
+    chunk->prts[p].row_idxs[idx] = row_idx - row_starts[p / chunk->col_div];
+    chunk->prts[p].col_idxs[idx] = col_idx - col_starts[p % chunk->col_div];
+  }
+  return NULL;
+}
+
+/**
+ * @fn split_nodes
+ * @brief Splits the nodes into div ranges of whole blocks of 32 nodes.
+ * @param num_nodes the number of nodes, a multiple of 32 (and of 32 * div if counts is NULL).
+ * @param div the number of ranges.
+ * @param counts the number of edges of each block, to give the ranges about as many edges each, or NULL to give
+ * them as many nodes each.
+ * @return the first node of each range, then num_nodes.
+ */
+uint32_t *split_nodes(uint32_t num_nodes, uint32_t div, uint64_t *counts) {
+  uint32_t *starts = malloc((div + 1) * sizeof(uint32_t));
+  uint32_t num_blocks = num_nodes / 32;
+  starts[0] = 0;
+  starts[div] = num_nodes;
+  if (counts == NULL) {
+    for (uint32_t k = 1; k < div; ++k)
+      starts[k] = k * (num_nodes / div);
+    return starts;
+  }
+
+  uint64_t total = 0;
+  for (uint32_t b = 0; b < num_blocks; ++b)
+    total += counts[b];
+
+  // End each range at the block boundary nearest to its share of the edges.
+  uint64_t sum = 0; // Number of edges before block b.
+  uint32_t b = 0;
+  for (uint32_t k = 1; k < div; ++k) {
+    uint64_t target = total * k / div;
+    while (b < num_blocks && sum + counts[b] <= target)
+      sum += counts[b++];
+    if (b < num_blocks && target - sum > sum + counts[b] - target)
+      sum += counts[b++];
+    starts[k] = b * 32;
+  }
+  return starts;
+}
 
-    nearest_factors(n, &row_div, &col_div);
-    num_rows /= row_div;
-    num_cols /= col_div;
+// Returns the range of each block of 32 nodes, from the starts of the ranges.
+uint32_t *block_ranges(uint32_t *starts, uint32_t div) {
+  uint32_t *ranges = malloc(starts[div] / 32 * sizeof(uint32_t));
+  for (uint32_t k = 0; k < div; ++k)
+    for (uint32_t b = starts[k] / 32; b < starts[k + 1] / 32; ++b)
+      ranges[b] = k;
+  return ranges;
+}
 
-    for (uint32_t i = 0; i < coo.num_edges; ++i) {
-      uint32_t p_row = coo.row_idxs[i] / num_rows; // Partition row index.
-      uint32_t p_col = coo.col_idxs[i] / num_cols; // Partition col index.
-      uint32_t p = p_row * col_div + p_col;        // col-major index of coo.
-      prts[p].num_edges++;
+// Returns the width of the widest range.
+uint32_t max_range(uint32_t *starts, uint32_t div) {
+  uint32_t max = 0;
+  for (uint32_t k = 0; k < div; ++k)
+    max = starts[k + 1] - starts[k] > max ? starts[k + 1] - starts[k] : max;
+  return max;
+}
+
+// Edges sampled from a COO matrix, to estimate its partitions without binning all its edges.
+struct edge_sample {
+  struct COO *coo;        // Whole COO matrix, or the sampled edges (see sample_datafile).
+  uint64_t num_edges;     // Number of edges of the whole COO matrix.
+  uint64_t step;          // Distance between the sampled edges.
+  uint64_t num_samples;   // Number of sampled edges.
+  uint64_t *block_counts; // Sampled edges of each block of 32 rows, then of 32 cols, if balanced, or NULL.
+};
+
+// Samples up to GRID_SAMPLES edges of a COO matrix, evenly spaced. Free the block counts of the sample.
+struct edge_sample sample_edges(struct COO *coo) {
+  struct edge_sample sample = {.coo = coo, .num_edges = coo->num_edges, .step = coo->num_edges / GRID_SAMPLES + 1};
+  sample.num_samples = coo->num_edges == 0 ? 0 : (coo->num_edges - 1) / sample.step + 1;
+
+  // Count the sampled edges of each block of rows and cols, to balance the ranges like partition_coo.
+  if (balanced) {
+    sample.block_counts = calloc((coo->num_rows + coo->num_cols) / 32, sizeof(uint64_t));
+    for (uint64_t i = 0; i < coo->num_edges; i += sample.step) {
+      sample.block_counts[coo->row_idxs[i] / 32]++;
+      sample.block_counts[coo->num_rows / 32 + coo->col_idxs[i] / 32]++;
     }
-    break;
   }
+  return sample;
+}
 
-  // Initialize COO partitions.
-  for (uint32_t i = 0; i < n; ++i) {
-    prts[i].num_rows = num_rows;
-    prts[i].num_cols = num_cols;
-    prts[i].row_idxs = malloc(prts[i].num_edges * sizeof(uint32_t));
-    prts[i].col_idxs = malloc(prts[i].num_edges * sizeof(uint32_t));
-    prts[i].num_edges = 0; // We'll re-increment as we append data.
+/**
+ * @fn sample_datafile
+ * @brief Samples up to GRID_SAMPLES edges of a datafile without parsing it whole: the edges of the lines found at
+ * evenly spaced places of the file, or all of them if there are fewer. Malformed lines are skipped.
+ * @param df the datafile.
+ * @param num_nodes the number of nodes, padded.
+ * @param offset the ID of the first node (see first_node).
+ * @return the sample of the edges of the datafile, whose block counts and sampled edges (sample.coo) must be freed.
+ */
+struct edge_sample sample_datafile(struct datafile *df, uint32_t num_nodes, uint32_t offset) {
+  const char *begin = df->chunks[0].begin;
+  const char *end = df->chunks[num_threads - 1].end;
+  bool all = df->num_edges <= GRID_SAMPLES;
+  uint64_t max_samples = all ? df->num_edges : GRID_SAMPLES;
+
+  struct COO *coo = malloc(sizeof(struct COO));
+  *coo = (struct COO){.num_rows = num_nodes, .num_cols = num_nodes};
+  coo->row_idxs = malloc(max_samples * sizeof(uint32_t));
+  coo->col_idxs = malloc(max_samples * sizeof(uint32_t));
+  const char *p = begin;
+  for (uint64_t k = 0; k < max_samples; ++k) {
+    // Go to the first line that starts at the k-th place.
+    if (!all) {
+      p = begin + (size_t)(end - begin) * k / max_samples;
+      if (p > begin && p[-1] != '\n')
+        p = line_end(p, end) + 1;
+    }
+    while (p < end) {
+      const char *line = p;
+      const char *eol = line_end(line, end);
+      p = eol + 1;
+      uint32_t row_idx, col_idx;
+      if (!is_blank_line(line, eol) && parse_edge(line, eol, &row_idx, &col_idx)) {
+        coo->row_idxs[coo->num_edges] = row_idx - offset;
+        coo->col_idxs[coo->num_edges++] = col_idx - offset;
+        break;
+      }
+    }
   }
 
-  // Bin row and col pairs.
-  for (uint32_t i = 0; i < coo.num_edges; ++i) {
-    uint32_t row_idx = coo.row_idxs[i];
-    uint32_t col_idx = coo.col_idxs[i];
+  struct edge_sample sample = sample_edges(coo);
+  sample.num_edges = df->num_edges;
+  return sample;
+}
 
-    uint32_t p = 0;
+/**
+ * @fn sample_partitions
+ * @brief Estimates the partitions of a grid from a sample of the edges, with the node ranges that partition_coo would
+ * make.
+ * @param sample the sample of the edges.
+ * @param num_nodes the number of nodes, padded for the grid (the nodes of the COO matrix if balanced).
+ * @param row_div the number of partitions per column of the adjacency matrix.
+ * @param col_div the number of partitions per row of the adjacency matrix.
+ * @param num_rows the number of rows of each partition, set.
+ * @param num_cols the number of cols of each partition, set.
+ * @return the estimated number of edges of the largest partition.
+ */
+uint64_t sample_partitions(struct edge_sample *sample, uint32_t num_nodes, uint32_t row_div, uint32_t col_div, uint32_t *num_rows, uint32_t *num_cols) {
+  struct COO *coo = sample->coo;
+  uint64_t *col_counts = sample->block_counts ? &sample->block_counts[coo->num_rows / 32] : NULL;
+  uint32_t *starts[2] = {split_nodes(num_nodes, row_div, sample->block_counts), split_nodes(num_nodes, col_div, col_counts)};
+  uint32_t *row_ranges = block_ranges(starts[0], row_div);
+  uint32_t *col_ranges = block_ranges(starts[1], col_div);
+  *num_rows = max_range(starts[0], row_div);
+  *num_cols = max_range(starts[1], col_div);
+
+  uint32_t *counts = calloc((size_t)row_div * col_div, sizeof(uint32_t));
+  uint32_t max_count = 0;
+  for (uint64_t i = 0; i < coo->num_edges; i += sample->step) {
+    uint32_t p = edge_partition(coo->row_idxs[i], coo->col_idxs[i], row_ranges, col_ranges, col_div);
+    max_count = ++counts[p] > max_count ? counts[p] : max_count;
+  }
 
-    if (prt == Row)
-      p = row_idx / num_rows;
-    else if (prt == Col)
-      p = col_idx / num_cols;
-    else if (prt == _2D) {
-      uint32_t p_row = row_idx / num_rows;
-      uint32_t p_col = col_idx / num_cols;
-      p = p_row * col_div + p_col;
+  free(counts);
+  free(col_ranges);
+  free(row_ranges);
+  free(starts[1]);
+  free(starts[0]);
+  return sample->num_samples ? max_count * sample->num_edges / sample->num_samples : 0;
+}
+
+/**
+ * @fn predict_level
+ * @brief Predicts the time of a BFS level on a grid of partitions, with dense frontiers: the host sends both frontiers
+ * to every DPU and merges the next frontiers of all DPUs, while the slowest DPU scans its frontiers and visited,
+ * and processes its share (1/GRID_LEVELS) of the edges of the largest partition.
+ * @param row_div the number of partitions per column of the adjacency matrix.
+ * @param col_div the number of partitions per row of the adjacency matrix.
+ * @param num_nodes the number of nodes of the graph.
+ * @param max_edges the number of edges of the largest partition.
+ */
+struct level_cost predict_level(uint32_t row_div, uint32_t col_div, uint32_t num_nodes, uint64_t max_edges) {
+  uint32_t n = row_div * col_div;
+  double len_cf = (double)num_nodes / nodes_per_word / row_div;
+  double len_nf = (double)num_nodes / nodes_per_word / col_div;
+  struct level_cost cost;
+  cost.comm = n * (len_cf + len_nf) * sizeof(uint32_t) / COST_TO_DPU_BANDWIDTH + n * len_nf * sizeof(uint32_t) / COST_FROM_DPU_BANDWIDTH;
+  cost.aggr = n * len_nf * sizeof(uint32_t) / COST_MERGE_BANDWIDTH;
+  cost.dpu = ((len_cf + 2 * len_nf) * COST_CYCLES_PER_WORD + (double)max_edges / GRID_LEVELS * COST_CYCLES_PER_EDGE) / COST_DPU_FREQUENCY;
+  return cost;
+}
+
+/**
+ * @fn choose_grid
+ * @brief Chooses the grid of a 2D partitioning with the lowest predicted time per level (see predict_level), among
+ * all the grids of n DPUs, from 1 x n to n x 1, that fit the MRAM. The partitions of each grid are estimated from
+ * a sample of the edges (see sample_partitions). Sets grid_row_div and grid_col_div.
+ * @param sample the sample of the edges, with nodes padded for any grid of n DPUs.
+ * @param n the number of DPUs.
+ * @param alg the BFS algorithm, that determines the MRAM used.
+ */
+void choose_grid(struct edge_sample *sample, uint32_t n, enum Algorithm alg) {
+  uint32_t num_nodes = sample->coo->num_rows;
+  double best = INFINITY;
+  bool best_fits = false;
+  for (uint32_t row_div = 1; row_div <= n; ++row_div) {
+    if (n % row_div != 0)
+      continue;
+    uint32_t col_div = n / row_div;
+
+    uint32_t num_rows, num_cols;
+    uint64_t max_edges = sample_partitions(sample, num_nodes, row_div, col_div, &num_rows, &num_cols);
+    bool fits = mram_bytes(alg, num_rows, num_cols, max_edges) <= MRAM_SIZE;
+    struct level_cost cost = predict_level(row_div, col_div, num_nodes, max_edges);
+    double total = cost.comm + cost.aggr + cost.dpu;
+    PRINT_INFO("Grid %u x %u: about %lu edges in the largest partition. Predicted %.3f ms per level (transfers %.3f, merge %.3f, DPU %.3f)%s.",
+               row_div, col_div, max_edges, total * 1e3, cost.comm * 1e3, cost.aggr * 1e3, cost.dpu * 1e3, fits ? "" : ", too large for the MRAM");
+    if ((fits && !best_fits) || (fits == best_fits && total < best)) {
+      best = total;
+      best_fits = fits;
+      grid_row_div = row_div;
+      grid_col_div = col_div;
+    }
+  }
+  PRINT_INFO("Partitioning: 2D grid of %u x %u DPUs.", grid_row_div, grid_col_div);
+}
+
+/**
+ * @fn fit_grid
+ * @brief Finds a grid of n DPUs for a partitioning whose partitions fit the MRAM, from a sample of the edges.
+ * @param sample the sample of the edges.
+ * @param alg the BFS algorithm.
+ * @param prt the partitioning.
+ * @param n the number of DPUs.
+ * @param row_div the number of partitions per column of the grid found, set.
+ * @param col_div the number of partitions per row of the grid found, set.
+ * @return whether a grid fits.
+ */
+bool fit_grid(struct edge_sample *sample, enum Algorithm alg, enum Partition prt, uint32_t n, uint32_t *row_div, uint32_t *col_div) {
+  uint32_t num_nodes = balanced ? sample->coo->num_rows : padded_nodes(sample->coo->num_rows, n);
+  for (uint32_t r = 1; r <= n; ++r) {
+    if ((prt == Row && r != n) || (prt == Col && r != 1) || n % r != 0)
+      continue;
+    uint32_t num_rows, num_cols;
+    uint64_t max_edges = sample_partitions(sample, num_nodes, r, n / r, &num_rows, &num_cols);
+    if (mram_bytes(alg, num_rows, num_cols, max_edges) <= MRAM_SIZE) {
+      *row_div = r;
+      *col_div = n / r;
+      return true;
     }
+  }
+  return false;
+}
 
-    uint32_t idx = prts[p].num_edges;
-    prts[p].row_idxs[idx] = row_idx;
-    prts[p].col_idxs[idx] = col_idx;
-    prts[p].num_edges++;
+/**
+ * @fn check_mram
+ * @brief Checks that the partitions fit the MRAM of a DPU, before they are built. If they do not, and their edges
+ * cannot be streamed (see plan_segments), reports the number of DPUs on which each partitioning would fit, estimated
+ * from a sample of the edges, and exits.
+ * @param sample the sample of the edges.
+ * @param alg the BFS algorithm.
+ * @param num_rows the number of rows of each partition.
+ * @param num_cols the number of cols of each partition.
+ * @param max_edges the number of edges of the largest partition.
+ */
+void check_mram(struct edge_sample *sample, enum Algorithm alg, uint32_t num_rows, uint32_t num_cols, uint64_t max_edges) {
+  uint64_t bytes = mram_bytes(alg, num_rows, num_cols, max_edges);
+  if (bytes <= MRAM_SIZE || alg == Cpu)
+    return;
+  if (alg == TopDown && !multi_source && mram_bytes(alg, num_rows, num_cols, 0) < MRAM_SIZE) {
+    PRINT_INFO("The partitions need %lu bytes of MRAM per DPU, more than the %u bytes of a DPU: their edges will be streamed.", bytes, MRAM_SIZE);
+    return;
   }
+  PRINT_ERROR("The partitions need %lu bytes of MRAM per DPU, more than the %u bytes of a DPU.", bytes, MRAM_SIZE);
+
+  // The MRAM needed shrinks with the number of DPUs: find the smallest multiple of 8 that fits by bisection.
+  for (enum Partition prt = Row; prt <= _2D; ++prt) {
+    uint32_t row_div, col_div;
+    uint32_t lo = 1, hi = TUNE_MAX_DPUS / 8;
+    if (!fit_grid(sample, alg, prt, hi * 8, &row_div, &col_div)) {
+      PRINT_INFO("With -p %s, the graph does not fit on up to %u DPUs.", prt_names[prt], TUNE_MAX_DPUS);
+      continue;
+    }
+    while (lo < hi) {
+      uint32_t mid = (lo + hi) / 2;
+      if (fit_grid(sample, alg, prt, mid * 8, &row_div, &col_div))
+        hi = mid;
+      else
+        lo = mid + 1;
+    }
+    fit_grid(sample, alg, prt, lo * 8, &row_div, &col_div);
+    PRINT_INFO("With -p %s, the graph fits on %u DPUs (grid of %u x %u).", prt_names[prt], lo * 8, row_div, col_div);
+  }
+  exit(1);
+}
 
-  // Offset nodes.
-  for (uint32_t p = 0; p < n; ++p) {
-    uint32_t row_offset = offset_row ? p / col_div * num_rows : 0;
-    uint32_t col_offset = offset_col ? p % col_div * num_cols : 0;
+// Partition COO matrix into n COO matrices by col, or by row, or both (2D). Assumes n is even.
+// The node ranges of the partitions are set in row_starts and col_starts. They have as many nodes each, or if
+// balanced is set, about as many edges each: rows are split by out-degree and cols by in-degree, at 32 nodes
+// boundaries. All partitions are then as large as the widest ranges.
+// The edges are split into num_threads ranges: each thread counts the edges of its range per partition, then
+// bins them after the edges of the previous ranges, so the edges of a partition keep their order in the COO.
+// The partitions share two arrays (an arena), that start at the arrays of partition 0: free them with free_coo_prts.
+struct COO *partition_coo(struct COO coo, uint32_t n, enum Partition prt, enum Algorithm alg) {
+
+  PRINT_INFO("Partitioning adjacency matrix into %u parts.", n);
+
+  struct COO *prts = malloc(n * sizeof(struct COO));
+
+  uint32_t row_div = 1;
+  uint32_t col_div = 1;
+
+  // Determine the number of row and col ranges.
+  if (prt == Row)
+    row_div = n;
+  else if (prt == Col)
+    col_div = n;
+  else
+    grid_2d(n, &row_div, &col_div);
+
+  struct partition_chunk chunks[num_threads];
+  pthread_t threads[num_threads];
+  for (uint32_t t = 0; t < num_threads; ++t)
+    chunks[t] = (struct partition_chunk){
+        .coo = &coo,
+        .prts = prts,
+        .from = (uint64_t)coo.num_edges * t / num_threads,
+        .to = (uint64_t)coo.num_edges * (t + 1) / num_threads,
+        .col_div = col_div};
+
+  // Split the nodes, counting the edges of each block of rows and cols to balance them.
+  uint64_t *block_counts = NULL;
+  if (balanced) {
+    block_counts = calloc((coo.num_rows + coo.num_cols) / 32, sizeof(uint64_t));
+    for (uint32_t t = 0; t < num_threads; ++t) {
+      chunks[t].counts = block_counts;
+      pthread_create(&threads[t], NULL, count_blocks, &chunks[t]);
+    }
+    for (uint32_t t = 0; t < num_threads; ++t)
+      pthread_join(threads[t], NULL);
+  }
+  row_starts = split_nodes(coo.num_rows, row_div, block_counts);
+  col_starts = split_nodes(coo.num_cols, col_div, block_counts ? &block_counts[coo.num_rows / 32] : NULL);
+  free(block_counts);
+
+  uint32_t *row_ranges = block_ranges(row_starts, row_div);
+  uint32_t *col_ranges = block_ranges(col_starts, col_div);
+  uint32_t num_rows = max_range(row_starts, row_div);
+  uint32_t num_cols = max_range(col_starts, col_div);
+  for (uint32_t i = 0; i < n; ++i) {
+    prts[i].num_rows = num_rows;
+    prts[i].num_cols = num_cols;
+  }
 
-    for (uint32_t i = 0; i < prts[p].num_edges; ++i) {
-      prts[p].row_idxs[i] -= row_offset;
-      prts[p].col_idxs[i] -= col_offset;
+  // Count the edges of each range per partition.
+  uint64_t *counts = calloc((size_t)num_threads * n, sizeof(uint64_t));
+  for (uint32_t t = 0; t < num_threads; ++t) {
+    chunks[t].row_ranges = row_ranges;
+    chunks[t].col_ranges = col_ranges;
+    chunks[t].counts = &counts[(size_t)t * n];
+    pthread_create(&threads[t], NULL, count_partitions, &chunks[t]);
+  }
+  for (uint32_t t = 0; t < num_threads; ++t)
+    pthread_join(threads[t], NULL);
+
+  // Prefix sum the counts, partition by partition, then range by range.
+  // The arena has a spare word, as MRAM transfers of odd lengths read one word past the end of a partition.
+  uint64_t max_edges = 0;
+  for (uint32_t p = 0; p < n; ++p) {
+    uint64_t edges = 0;
+    for (uint32_t t = 0; t < num_threads; ++t)
+      edges += counts[(size_t)t * n + p];
+    max_edges = edges > max_edges ? edges : max_edges;
+  }
+  PRINT_INFO("Partitions of %u x %u nodes. The largest has %lu edges, %.2fx the average.", num_rows, num_cols, max_edges,
+             coo.num_edges ? (double)max_edges * n / coo.num_edges : 1.0);
+  struct edge_sample sample = sample_edges(&coo);
+  check_mram(&sample, alg, num_rows, num_cols, max_edges);
+  free(sample.block_counts);
+
+  uint32_t *row_arena = malloc((coo.num_edges + 1) * sizeof(uint32_t));
+  uint32_t *col_arena = malloc((coo.num_edges + 1) * sizeof(uint32_t));
+  uint64_t offset = 0;
+  for (uint32_t p = 0; p < n; ++p) {
+    prts[p].row_idxs = &row_arena[offset];
+    prts[p].col_idxs = &col_arena[offset];
+    uint64_t start = 0;
+    for (uint32_t t = 0; t < num_threads; ++t) {
+      uint64_t count = counts[(size_t)t * n + p];
+      counts[(size_t)t * n + p] = start;
+      start += count;
     }
+    prts[p].num_edges = start;
+    offset += start;
   }
 
+  // Bin the edges.
+  for (uint32_t t = 0; t < num_threads; ++t)
+    pthread_create(&threads[t], NULL, scatter_partitions, &chunks[t]);
+  for (uint32_t t = 0; t < num_threads; ++t)
+    pthread_join(threads[t], NULL);
+
+  free(counts);
+  free(row_ranges);
+  free(col_ranges);
   return prts;
 }
 
-// Converts COO matrix to CSR format.
-struct CSR coo_to_csr(struct COO coo) {
+// Turns a histogram of num_ptrs - 1 rows (or cols) into the starts of their nonzeros, and the total in the last ptr.
+void prefix_sum_ptrs(uint32_t *ptrs, uint32_t num_ptrs) {
+  uint32_t sum_before_next = 0;
+  for (uint32_t k = 0; k < num_ptrs - 1; ++k) {
+    uint32_t sum_before = sum_before_next;
+    sum_before_next += ptrs[k];
+    ptrs[k] = sum_before;
+  }
+  ptrs[num_ptrs - 1] = sum_before_next;
+}
 
-  struct CSR csr;
+// Shifts back ptrs advanced past their nonzeros by the binning, so each points to the start of its nonzeros again.
+void restore_ptrs(uint32_t *ptrs, uint32_t num_ptrs) {
+  for (uint32_t k = num_ptrs - 1; k > 0; --k)
+    ptrs[k] = ptrs[k - 1];
+  ptrs[0] = 0;
+}
 
-  // Initialize fields.
-  csr.num_rows = coo.num_rows;
-  csr.num_cols = coo.num_cols;
-  csr.num_edges = coo.num_edges;
-  csr.row_ptrs = calloc((csr.num_rows + 1), sizeof(uint32_t));
-  csr.col_idxs = malloc(csr.num_edges * sizeof(uint32_t));
-
-  // Histogram row_idxs.
-  for (uint32_t i = 0; i < coo.num_edges; ++i) {
-    uint32_t row_idx = coo.row_idxs[i];
-    csr.row_ptrs[row_idx]++;
+// Like prefix_sum_ptrs, with 64-bit offsets, for arrays of the whole graph that can have more than 4G nonzeros.
+void prefix_sum_offsets(uint64_t *offsets, uint32_t num_offsets) {
+  uint64_t sum = 0;
+  for (uint32_t k = 0; k < num_offsets - 1; ++k) {
+    uint64_t count = offsets[k];
+    offsets[k] = sum;
+    sum += count;
+  }
+  offsets[num_offsets - 1] = sum;
+}
+
+// Like restore_ptrs, with 64-bit offsets.
+void restore_offsets(uint64_t *offsets, uint32_t num_offsets) {
+  for (uint32_t k = num_offsets - 1; k > 0; --k)
+    offsets[k] = offsets[k - 1];
+  offsets[0] = 0;
+}
+
+// Range of edges of the COO handled by a reordering thread.
+struct reorder_chunk {
+  struct COO *coo;  // Whole COO matrix.
+  uint64_t from;    // First edge of the range.
+  uint64_t to;      // One past the last edge of the range.
+  uint32_t *nodes;  // Degree of each node (count_degrees), or new ID of each node (relabel_edges).
+};
+
+// Adds the edges of a range to the degrees (in and out) of their nodes.
+void *count_degrees(void *arg) {
+  struct reorder_chunk *chunk = arg;
+  for (uint64_t i = chunk->from; i < chunk->to; ++i) {
+    __atomic_fetch_add(&chunk->nodes[chunk->coo->row_idxs[i]], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&chunk->nodes[chunk->coo->col_idxs[i]], 1, __ATOMIC_RELAXED);
   }
+  return NULL;
+}
 
-  // Prefix sum row_ptrs.
-  uint32_t sum_before_next_row = 0;
-  for (uint32_t row_idx = 0; row_idx < csr.num_rows; ++row_idx) {
-    uint32_t sum_before_row = sum_before_next_row;
-    sum_before_next_row += csr.row_ptrs[row_idx];
-    csr.row_ptrs[row_idx] = sum_before_row;
+// Relabels the nodes of the edges of a range.
+void *relabel_edges(void *arg) {
+  struct reorder_chunk *chunk = arg;
+  for (uint64_t i = chunk->from; i < chunk->to; ++i) {
+    chunk->coo->row_idxs[i] = chunk->nodes[chunk->coo->row_idxs[i]];
+    chunk->coo->col_idxs[i] = chunk->nodes[chunk->coo->col_idxs[i]];
   }
-  csr.row_ptrs[csr.num_rows] = sum_before_next_row;
+  return NULL;
+}
 
-  // Bin the nonzeros.
-  for (uint32_t i = 0; i < coo.num_edges; ++i) {
-    uint32_t row_idx = coo.row_idxs[i];
-    uint32_t nnzIdx = csr.row_ptrs[row_idx]++;
-    csr.col_idxs[nnzIdx] = coo.col_idxs[i];
+// Runs a reordering thread function on num_threads ranges of the edges.
+void run_reorder_chunks(struct COO *coo, uint32_t *nodes, void *(*fn)(void *)) {
+  struct reorder_chunk chunks[num_threads];
+  pthread_t threads[num_threads];
+  for (uint32_t t = 0; t < num_threads; ++t) {
+    chunks[t] = (struct reorder_chunk){
+        .coo = coo,
+        .from = (uint64_t)coo->num_edges * t / num_threads,
+        .to = (uint64_t)coo->num_edges * (t + 1) / num_threads,
+        .nodes = nodes};
+    pthread_create(&threads[t], NULL, fn, &chunks[t]);
+  }
+  for (uint32_t t = 0; t < num_threads; ++t)
+    pthread_join(threads[t], NULL);
+}
+
+// Orders the nodes by decreasing degree, keeping the order of the nodes of the same degree (counting sort).
+void order_by_degree(uint32_t *degrees, uint32_t num_nodes, uint32_t *nodes) {
+  uint32_t max_degree = 0;
+  for (uint32_t u = 0; u < num_nodes; ++u)
+    max_degree = degrees[u] > max_degree ? degrees[u] : max_degree;
+
+  uint32_t *starts = calloc((size_t)max_degree + 2, sizeof(uint32_t));
+  for (uint32_t u = 0; u < num_nodes; ++u)
+    starts[max_degree - degrees[u] + 1]++;
+  for (uint32_t d = 1; d <= max_degree + 1; ++d)
+    starts[d] += starts[d - 1];
+  for (uint32_t u = 0; u < num_nodes; ++u)
+    nodes[starts[max_degree - degrees[u]]++] = u;
+  free(starts);
+}
+
+// Orders the nodes of above average degree first, then the other nodes with edges, then the nodes without edges,
+// keeping the order of the datafile in each group. num_degrees is the sum of the degrees.
+void order_hubs(uint32_t *degrees, uint32_t num_nodes, uint64_t num_degrees, uint32_t *nodes) {
+  uint32_t count = 0;
+  for (uint32_t u = 0; u < num_nodes; ++u)
+    if ((uint64_t)degrees[u] * num_nodes > num_degrees)
+      nodes[count++] = u;
+  for (uint32_t u = 0; u < num_nodes; ++u)
+    if (degrees[u] != 0 && (uint64_t)degrees[u] * num_nodes <= num_degrees)
+      nodes[count++] = u;
+  for (uint32_t u = 0; u < num_nodes; ++u)
+    if (degrees[u] == 0)
+      nodes[count++] = u;
+}
+
+uint32_t *rcm_degrees; // Degrees compared by compare_degrees.
+
+// Compares two nodes by increasing degree.
+int compare_degrees(const void *a, const void *b) {
+  uint32_t da = rcm_degrees[*(const uint32_t *)a];
+  uint32_t db = rcm_degrees[*(const uint32_t *)b];
+  return da < db ? -1 : da > db;
+}
+
+/**
+ * @fn order_rcm
+ * @brief Orders the nodes by Reverse Cuthill-McKee, on the graph with the edges in both directions: each connected
+ * component is traversed breadth-first from one of its nodes of lowest degree, visiting the neighbors of a node by
+ * increasing degree, and the order is reversed. Nodes without edges are left at the end.
+ * @param coo the COO matrix.
+ * @param degrees the degree (in and out) of each node.
+ * @param nodes the order of the nodes, filled.
+ */
+void order_rcm(struct COO *coo, uint32_t *degrees, uint32_t *nodes) {
+  uint32_t num_nodes = coo->num_rows;
+
+  // Neighbors of each node, in both directions.
+  uint64_t *ptrs = malloc(((size_t)num_nodes + 1) * sizeof(uint64_t));
+  for (uint32_t u = 0; u < num_nodes; ++u)
+    ptrs[u] = degrees[u];
+  prefix_sum_offsets(ptrs, num_nodes + 1);
+  uint32_t *neighbors = malloc((ptrs[num_nodes] + 1) * sizeof(uint32_t));
+  for (uint64_t i = 0; i < coo->num_edges; ++i) {
+    neighbors[ptrs[coo->row_idxs[i]]++] = coo->col_idxs[i];
+    neighbors[ptrs[coo->col_idxs[i]]++] = coo->row_idxs[i];
+  }
+  restore_offsets(ptrs, num_nodes + 1);
+
+  // Start each component from its first node of lowest degree.
+  uint32_t *by_degree = malloc(num_nodes * sizeof(uint32_t));
+  order_by_degree(degrees, num_nodes, by_degree);
+  bool *visited = calloc(num_nodes, sizeof(bool));
+  rcm_degrees = degrees;
+
+  uint32_t head = 0, tail = 0; // nodes is the queue of the traversal.
+  for (uint32_t k = num_nodes; k-- > 0;) {
+    uint32_t start = by_degree[k];
+    if (visited[start] || degrees[start] == 0)
+      continue;
+    visited[start] = true;
+    nodes[tail++] = start;
+    while (head < tail) {
+      uint32_t u = nodes[head++];
+      uint32_t first = tail;
+      for (uint64_t e = ptrs[u]; e < ptrs[u + 1]; ++e)
+        if (!visited[neighbors[e]]) {
+          visited[neighbors[e]] = true;
+          nodes[tail++] = neighbors[e];
+        }
+      qsort(&nodes[first], tail - first, sizeof(uint32_t), compare_degrees);
+    }
   }
 
-  // Restore rowPtrs.
-  for (uint32_t row_idx = csr.num_rows - 1; row_idx > 0; --row_idx)
-    csr.row_ptrs[row_idx] = csr.row_ptrs[row_idx - 1];
-  csr.row_ptrs[0] = 0;
+  for (uint32_t i = 0; i < tail / 2; ++i) {
+    uint32_t u = nodes[i];
+    nodes[i] = nodes[tail - 1 - i];
+    nodes[tail - 1 - i] = u;
+  }
+  for (uint32_t u = 0; u < num_nodes; ++u)
+    if (!visited[u])
+      nodes[tail++] = u;
+
+  free(visited);
+  free(by_degree);
+  free(neighbors);
+  free(ptrs);
+}
 
-  return csr;
+/**
+ * @fn reorder_coo
+ * @brief Relabels the nodes of a COO matrix, so that nodes that are reached together have close IDs, and the words
+ * of the frontiers are denser. Sets new_ids. Nodes without edges (including padding) end up last in every order.
+ * @param coo the COO matrix, relabeled in place by num_threads threads.
+ * @param order the order of the nodes.
+ */
+void reorder_coo(struct COO *coo, enum Order order) {
+  static const char *names[] = {"", "decreasing degree", "Reverse Cuthill-McKee", "hub clustering"};
+  PRINT_INFO("Reordering nodes by %s.", names[order]);
+
+  uint32_t num_nodes = coo->num_rows;
+  uint32_t *degrees = calloc(num_nodes, sizeof(uint32_t));
+  run_reorder_chunks(coo, degrees, count_degrees);
+
+  uint32_t *nodes = malloc(num_nodes * sizeof(uint32_t)); // Node of the datafile of each new ID.
+  if (order == OrderDegree)
+    order_by_degree(degrees, num_nodes, nodes);
+  else if (order == OrderRCM)
+    order_rcm(coo, degrees, nodes);
+  else
+    order_hubs(degrees, num_nodes, 2 * (uint64_t)coo->num_edges, nodes);
+
+  new_ids = malloc(num_nodes * sizeof(uint32_t));
+  for (uint32_t k = 0; k < num_nodes; ++k)
+    new_ids[nodes[k]] = k;
+  run_reorder_chunks(coo, new_ids, relabel_edges);
+
+  free(nodes);
+  free(degrees);
 }
 
-// Converts COO matrix to CSC format.
-struct CSC coo_to_csc(struct COO coo) {
+// Converts COO matrix to CSR format, to CSC format, or to both (a NULL output is skipped).
+// Both formats are built together, with a single histogram pass and a single binning pass over the COO.
+// The arrays of the outputs must already be allocated.
+void coo_to_csr_csc(struct COO coo, struct CSR *csr, struct CSC *csc) {
+
+  // Initialize fields.
+  if (csr) {
+    csr->num_rows = coo.num_rows;
+    csr->num_cols = coo.num_cols;
+    csr->num_edges = coo.num_edges;
+    memset(csr->row_ptrs, 0, (coo.num_rows + 1) * sizeof(uint32_t));
+  }
+  if (csc) {
+    csc->num_rows = coo.num_rows;
+    csc->num_cols = coo.num_cols;
+    csc->num_edges = coo.num_edges;
+    memset(csc->col_ptrs, 0, (coo.num_cols + 1) * sizeof(uint32_t));
+  }
+
+  // Histogram row_idxs and col_idxs.
+  for (uint64_t i = 0; i < coo.num_edges; ++i) {
+    if (csr)
+      csr->row_ptrs[coo.row_idxs[i]]++;
+    if (csc)
+      csc->col_ptrs[coo.col_idxs[i]]++;
+  }
 
-  // Transpose COO matrix.
-  struct COO coo_trs = {
-      .col_idxs = coo.row_idxs,
-      .row_idxs = coo.col_idxs,
-      .num_cols = coo.num_rows,
-      .num_rows = coo.num_cols,
-      .num_edges = coo.num_edges};
+  // Prefix sum row_ptrs and col_ptrs.
+  if (csr)
+    prefix_sum_ptrs(csr->row_ptrs, coo.num_rows + 1);
+  if (csc)
+    prefix_sum_ptrs(csc->col_ptrs, coo.num_cols + 1);
 
-  // Convert to CSR, then CSC.
-  struct CSR csr = coo_to_csr(coo_trs);
-  struct CSC csc = {
-      .col_ptrs = csr.row_ptrs,
-      .row_idxs = csr.col_idxs,
-      .num_cols = csr.num_rows,
-      .num_rows = csr.num_cols,
-      .num_edges = coo.num_edges};
+  // Bin the nonzeros.
+  for (uint64_t i = 0; i < coo.num_edges; ++i) {
+    uint32_t row_idx = coo.row_idxs[i];
+    uint32_t col_idx = coo.col_idxs[i];
+    if (csr)
+      csr->col_idxs[csr->row_ptrs[row_idx]++] = col_idx;
+    if (csc)
+      csc->row_idxs[csc->col_ptrs[col_idx]++] = row_idx;
+  }
 
-  return csc;
+  // Restore row_ptrs and col_ptrs.
+  if (csr)
+    restore_ptrs(csr->row_ptrs, coo.num_rows + 1);
+  if (csc)
+    restore_ptrs(csc->col_ptrs, coo.num_cols + 1);
 }
 
 // Frees COO matrix.
@@ -532,19 +1989,951 @@ void free_coo(struct COO coo) {
   free(coo.col_idxs);
 }
 
-// Frees CSR matrix.
-void free_csr(struct CSR csr) {
-  free(csr.row_ptrs);
-  free(csr.col_idxs);
+// Frees COO partitions made by partition_coo.
+void free_coo_prts(struct COO *prts) {
+  free(prts[0].row_idxs);
+  free(prts[0].col_idxs);
+  free(prts);
+}
+
+// Frees CSR partitions made by build_graph.
+void free_csr_prts(struct CSR *prts) {
+  free(prts[0].row_ptrs);
+  free(prts[0].col_idxs);
+  free(prts);
+}
+
+// Frees CSC partitions made by build_graph.
+void free_csc_prts(struct CSC *prts) {
+  free(prts[0].col_ptrs);
+  free(prts[0].row_idxs);
+  free(prts);
+}
+
+/**
+ * @fn sweep_levels
+ * @brief Runs a BFS on the host, from a root, on the adjacency lists of the whole graph.
+ * @param num_nodes the number of nodes.
+ * @param offsets the start of the neighbors of each node, and their total in the last offset.
+ * @param neighbors the neighbors of the nodes.
+ * @param root the node the BFS starts from.
+ * @param levels the level of each node, filled (UINT32_MAX if not reached).
+ * @param queue a buffer of num_nodes nodes.
+ * @param last the last node reached, set.
+ * @return the number of levels.
+ */
+uint32_t sweep_levels(uint32_t num_nodes, uint64_t *offsets, uint32_t *neighbors, uint32_t root, uint32_t *levels, uint32_t *queue, uint32_t *last) {
+  memset(levels, 0xFF, num_nodes * sizeof(uint32_t));
+  levels[root] = 0;
+  queue[0] = root;
+  uint32_t head = 0, tail = 1;
+  while (head < tail) {
+    uint32_t u = queue[head++];
+    for (uint64_t e = offsets[u]; e < offsets[u + 1]; ++e)
+      if (levels[neighbors[e]] == UINT32_MAX) {
+        levels[neighbors[e]] = levels[u] + 1;
+        queue[tail++] = neighbors[e];
+      }
+  }
+  *last = queue[tail - 1];
+  return levels[*last] + 1;
+}
+
+/**
+ * @fn compute_stats
+ * @brief Computes the statistics of a graph compared by the auto-tuner. The diameter is estimated by a double sweep:
+ * a BFS from a node of highest out-degree, then a BFS from the last node it reached.
+ * @param coo the COO matrix.
+ * @param padding the number of nodes added by padding, that are not counted.
+ */
+struct graph_stats compute_stats(struct COO *coo, uint32_t padding) {
+  // Out-neighbors of each node, with 64-bit offsets as the whole graph can have more than 4G edges.
+  uint32_t num_nodes = coo->num_rows;
+  uint64_t *offsets = calloc((size_t)num_nodes + 1, sizeof(uint64_t));
+  uint32_t *neighbors = malloc((coo->num_edges + 1) * sizeof(uint32_t));
+  for (uint64_t i = 0; i < coo->num_edges; ++i)
+    offsets[coo->row_idxs[i]]++;
+  prefix_sum_offsets(offsets, num_nodes + 1);
+  for (uint64_t i = 0; i < coo->num_edges; ++i)
+    neighbors[offsets[coo->row_idxs[i]]++] = coo->col_idxs[i];
+  restore_offsets(offsets, num_nodes + 1);
+
+  struct graph_stats s = {.num_nodes = num_nodes - padding, .num_edges = coo->num_edges};
+  uint32_t hub = 0;
+  double sum_squares = 0;
+  for (uint32_t u = 0; u < num_nodes; ++u) {
+    uint64_t degree = offsets[u + 1] - offsets[u];
+    sum_squares += (double)degree * degree;
+    hub = degree > offsets[hub + 1] - offsets[hub] ? u : hub;
+  }
+  s.avg_degree = s.num_nodes ? (double)s.num_edges / s.num_nodes : 0;
+  s.degree_skew = s.avg_degree > 0 ? sqrt(fmax(sum_squares / s.num_nodes - s.avg_degree * s.avg_degree, 0)) / s.avg_degree : 0;
+
+  uint32_t *levels = malloc(num_nodes * sizeof(uint32_t));
+  uint32_t *queue = malloc(num_nodes * sizeof(uint32_t));
+  if (num_nodes) {
+    uint32_t last;
+    uint32_t first = sweep_levels(num_nodes, offsets, neighbors, hub, levels, queue, &last);
+    uint32_t second = sweep_levels(num_nodes, offsets, neighbors, last, levels, queue, &last);
+    s.diameter = (first > second ? first : second) - 1;
+  }
+
+  PRINT_INFO("Graph statistics: average degree %.2f, degree skew %.2f, estimated diameter %u.", s.avg_degree, s.degree_skew, s.diameter);
+  free(queue);
+  free(levels);
+  free(neighbors);
+  free(offsets);
+  return s;
+}
+
+// Returns the distance between the statistics of two graphs, on a log scale.
+double stats_distance(struct graph_stats *a, struct graph_stats *b) {
+  double d[] = {log2(1.0 + a->num_edges) - log2(1.0 + b->num_edges), log2(1 + a->avg_degree) - log2(1 + b->avg_degree),
+                log2(1 + a->degree_skew) - log2(1 + b->degree_skew), log2(1.0 + a->diameter) - log2(1.0 + b->diameter)};
+  return d[0] * d[0] + d[1] * d[1] + d[2] * d[2] + d[3] * d[3];
+}
+
+// Returns the index of a name in a list of count names, or count if it is not there.
+uint32_t find_name(const char **names, uint32_t count, const char *name) {
+  uint32_t i = 0;
+  while (i < count && strcmp(names[i], name) != 0)
+    ++i;
+  return i;
+}
+
+// Prints the options of a configuration, to pin it in later runs.
+void print_config(const char *how, uint32_t n, enum Algorithm alg, enum Partition prt) {
+  PRINT_INFO("%s configuration: -n %u -a %s -p %s", how, n, alg_names[alg], prt_names[prt]);
+}
+
+/**
+ * @fn tune_config
+ * @brief Chooses the algorithm, partitioning and number of DPUs that are auto (auto_alg, auto_prt, auto_dpu).
+ * Among the runs of the calibration table that have the options which are not auto, the fastest run of the graph
+ * nearest to this one is chosen (see stats_distance). Without such runs, the algorithm is hybrid on graphs of
+ * diameter up to TUNE_HYBRID_DIAMETER and top-down otherwise, partitioned like with -a, on one DPU per
+ * TUNE_EDGES_PER_DPU edges.
+ * @param s the statistics of the graph.
+ * @param n the number of DPUs.
+ * @param alg the BFS algorithm.
+ * @param prt the partitioning of the graph.
+ */
+void tune_config(struct graph_stats *s, uint32_t *n, enum Algorithm *alg, enum Partition *prt) {
+  FILE *fp = fopen(calibration_file, "r");
+  if (fp == NULL)
+    PRINT_WARNING("Could not open calibration table %s.", calibration_file);
+
+  // Lines are: datafile num_nodes num_edges avg_degree degree_skew diameter alg prt num_dpus total_alg.
+  char *line = NULL;
+  size_t cap = 0;
+  double best_distance = INFINITY, best_time = INFINITY;
+  while (fp != NULL && getline(&line, &cap, fp) != -1) {
+    struct graph_stats run;
+    char alg_name[16], prt_name[16];
+    uint32_t run_n;
+    double time;
+    if (sscanf(line, "%*s %u %lu %lf %lf %u %15s %15s %u %lf", &run.num_nodes, &run.num_edges, &run.avg_degree,
+               &run.degree_skew, &run.diameter, alg_name, prt_name, &run_n, &time) != 9)
+      continue; // Header or malformed line.
+    uint32_t run_alg = find_name(alg_names, 4, alg_name);
+    uint32_t run_prt = find_name(prt_names, 3, prt_name);
+    if (run_alg == 4 || run_prt == 3 || run_n == 0 || run_n % 8 != 0 || (multi_source && run_alg == Hybrid) ||
+        (!auto_alg && run_alg != *alg) || (!auto_prt && run_prt != *prt) || (!auto_dpu && run_n != *n))
+      continue;
+
+    double distance = stats_distance(s, &run);
+    if (distance < best_distance || (distance == best_distance && time < best_time)) {
+      best_distance = distance;
+      best_time = time;
+      *alg = auto_alg ? run_alg : *alg;
+      *prt = auto_prt ? run_prt : *prt;
+      *n = auto_dpu ? run_n : *n;
+    }
+  }
+  free(line);
+  if (fp != NULL)
+    fclose(fp);
+
+  if (best_distance == INFINITY) {
+    PRINT_WARNING("No calibration run matches the options given. Using the default configuration.");
+    if (auto_alg)
+      *alg = s->diameter <= TUNE_HYBRID_DIAMETER && !multi_source ? Hybrid : TopDown;
+    if (auto_prt)
+      *prt = *alg == TopDown ? Row : *alg == BottomUp ? Col : _2D;
+    if (auto_dpu) {
+      uint64_t dpus = ROUND_UP_TO_MULTIPLE(s->num_edges / TUNE_EDGES_PER_DPU + 1, 8);
+      *n = dpus < TUNE_MAX_DPUS ? dpus : TUNE_MAX_DPUS;
+    }
+  }
+  print_config("Auto-tuned", *n, *alg, *prt);
+}
+
+// Computes the out-degree of each of the total_nodes nodes from the CSR partitions.
+uint32_t *out_degrees(struct CSR *csr, uint32_t n, uint32_t col_div, uint32_t total_nodes) {
+  uint32_t *degrees = calloc(total_nodes, sizeof(uint32_t));
+  for (uint32_t i = 0; i < n; ++i) {
+    uint32_t row_offset = row_starts[i / col_div];
+    uint32_t num_rows = row_starts[i / col_div + 1] - row_offset;
+    for (uint32_t r = 0; r < num_rows; ++r)
+      degrees[row_offset + r] += csr[i].row_ptrs[r + 1] - csr[i].row_ptrs[r];
+  }
+  return degrees;
+}
+
+// Returns the formats of the graph used by a BFS algorithm.
+uint32_t graph_formats(enum Algorithm alg) {
+  if (alg == TopDown)
+    return FormatCSR;
+  else if (alg == BottomUp)
+    return FormatCSC;
+  else if (alg == Edge)
+    return FormatCOO;
+  else
+    return FormatCSR | FormatCSC; // Hybrid and Cpu.
+}
+
+// Partitions converted by a pool of threads.
+struct convert_pool {
+  struct COO *coo;  // COO partitions.
+  struct CSR *csr;  // CSR partitions to build, or NULL.
+  struct CSC *csc;  // CSC partitions to build, or NULL.
+  uint32_t n;       // Number of partitions.
+  uint32_t next;    // Next partition to convert.
+};
+
+// Converts partitions until there is none left.
+void *convert_partitions(void *arg) {
+  struct convert_pool *pool = arg;
+  uint32_t i;
+  while ((i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED)) < pool->n)
+    coo_to_csr_csc(pool->coo[i], pool->csr ? &pool->csr[i] : NULL, pool->csc ? &pool->csc[i] : NULL);
+  return NULL;
+}
+
+/**
+ * @fn build_graph
+ * @brief Converts COO partitions to the formats used by a BFS algorithm. Frees the COO partitions if they are not kept.
+ * The partitions are converted by num_threads threads, CSR and CSC together in a single pass over each COO partition.
+ * Like the COO partitions, the partitions of each format share arrays that are allocated at once.
+ * @param coo the COO partitions made by partition_coo.
+ * @param n the number of partitions.
+ * @param alg the BFS algorithm.
+ */
+struct Graph build_graph(struct COO *coo, uint32_t n, enum Algorithm alg) {
+  uint32_t formats = graph_formats(alg);
+  struct Graph graph = {0};
+
+  // The edges of each partition have the same place in the arena of every format.
+  // Arenas have a spare word, as MRAM transfers of odd lengths read one word past the end of a partition.
+  uint32_t num_rows = coo[0].num_rows;
+  uint32_t num_cols = coo[0].num_cols;
+  size_t num_edges = coo[n - 1].row_idxs - coo[0].row_idxs + coo[n - 1].num_edges;
+
+  if (formats & FormatCSR) {
+    graph.csr = malloc(n * sizeof(struct CSR));
+    uint32_t *ptrs = malloc(((size_t)n * (num_rows + 1) + 1) * sizeof(uint32_t));
+    uint32_t *idxs = malloc((num_edges + 1) * sizeof(uint32_t));
+    for (uint32_t i = 0; i < n; ++i) {
+      graph.csr[i].row_ptrs = &ptrs[(size_t)i * (num_rows + 1)];
+      graph.csr[i].col_idxs = &idxs[coo[i].row_idxs - coo[0].row_idxs];
+    }
+  }
+  if (formats & FormatCSC) {
+    graph.csc = malloc(n * sizeof(struct CSC));
+    uint32_t *ptrs = malloc(((size_t)n * (num_cols + 1) + 1) * sizeof(uint32_t));
+    uint32_t *idxs = malloc((num_edges + 1) * sizeof(uint32_t));
+    for (uint32_t i = 0; i < n; ++i) {
+      graph.csc[i].col_ptrs = &ptrs[(size_t)i * (num_cols + 1)];
+      graph.csc[i].row_idxs = &idxs[coo[i].row_idxs - coo[0].row_idxs];
+    }
+  }
+
+  if (graph.csr || graph.csc) {
+    struct convert_pool pool = {.coo = coo, .csr = graph.csr, .csc = graph.csc, .n = n};
+    pthread_t threads[num_threads];
+    for (uint32_t t = 0; t < num_threads; ++t)
+      pthread_create(&threads[t], NULL, convert_partitions, &pool);
+    for (uint32_t t = 0; t < num_threads; ++t)
+      pthread_join(threads[t], NULL);
+  }
+
+  if (formats & FormatCOO)
+    graph.coo = coo;
+  else
+    free_coo_prts(coo);
+  return graph;
+}
+
+// Chunk of a datafile partitioned by a thread of load_partitions.
+struct ingest_chunk {
+  struct load_chunk *lines;   // Lines of the chunk.
+  struct partition_chunk prt; // Node ranges, and edges of the chunk in each partition (prt.coo has no edges).
+  struct Graph *graph;        // Partitions to fill.
+  uint32_t offset;            // ID of the first node, subtracted from the IDs of the datafile.
+};
+
+// Counts the edges of a chunk in each block of 32 rows and of 32 cols, as the row and col counts of prt.counts.
+void *ingest_blocks(void *arg) {
+  struct ingest_chunk *chunk = arg;
+  uint64_t *row_counts = chunk->prt.counts;
+  uint64_t *col_counts = &chunk->prt.counts[chunk->prt.coo->num_rows / 32];
+  const char *p = chunk->lines->begin;
+  uint32_t row_idx, col_idx;
+  for (uint64_t i = chunk->lines->first; next_edge(chunk->lines, &p, i, &row_idx, &col_idx); ++i) {
+    __atomic_fetch_add(&row_counts[(row_idx - chunk->offset) / 32], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&col_counts[(col_idx - chunk->offset) / 32], 1, __ATOMIC_RELAXED);
+  }
+  return NULL;
+}
+
+// Counts the edges of a chunk in each partition, and in each row (CSR) and col (CSC) of the partitions.
+void *ingest_counts(void *arg) {
+  struct ingest_chunk *chunk = arg;
+  struct partition_chunk *prt = &chunk->prt;
+  struct CSR *csr = chunk->graph->csr;
+  struct CSC *csc = chunk->graph->csc;
+  const char *p = chunk->lines->begin;
+  uint32_t row_idx, col_idx;
+  for (uint64_t i = chunk->lines->first; next_edge(chunk->lines, &p, i, &row_idx, &col_idx); ++i) {
+    row_idx -= chunk->offset;
+    col_idx -= chunk->offset;
+    uint32_t k = edge_partition(row_idx, col_idx, prt->row_ranges, prt->col_ranges, prt->col_div);
+    prt->counts[k]++;
+    if (csr)
+      __atomic_fetch_add(&csr[k].row_ptrs[row_idx - row_starts[k / prt->col_div]], 1, __ATOMIC_RELAXED);
+    if (csc)
+      __atomic_fetch_add(&csc[k].col_ptrs[col_idx - col_starts[k % prt->col_div]], 1, __ATOMIC_RELAXED);
+  }
+  return NULL;
+}
+
+// Bins the edges of a chunk in the partitions: after the edges of the previous chunks in COO partitions, and at the
+// next place of their row (CSR) and col (CSC), whose pointers are moved past it.
+void *ingest_edges(void *arg) {
+  struct ingest_chunk *chunk = arg;
+  struct partition_chunk *prt = &chunk->prt;
+  struct COO *coo = chunk->graph->coo;
+  struct CSR *csr = chunk->graph->csr;
+  struct CSC *csc = chunk->graph->csc;
+  const char *p = chunk->lines->begin;
+  uint32_t row_idx, col_idx;
+  for (uint64_t i = chunk->lines->first; next_edge(chunk->lines, &p, i, &row_idx, &col_idx); ++i) {
+    row_idx -= chunk->offset;
+    col_idx -= chunk->offset;
+    uint32_t k = edge_partition(row_idx, col_idx, prt->row_ranges, prt->col_ranges, prt->col_div);
+    row_idx -= row_starts[k / prt->col_div];
+    col_idx -= col_starts[k % prt->col_div];
+    if (coo) {
+      uint64_t idx = prt->counts[k]++;
+      coo[k].row_idxs[idx] = row_idx;
+      coo[k].col_idxs[idx] = col_idx;
+    }
+    if (csr)
+      csr[k].col_idxs[__atomic_fetch_add(&csr[k].row_ptrs[row_idx], 1, __ATOMIC_RELAXED)] = col_idx;
+    if (csc)
+      csc[k].row_idxs[__atomic_fetch_add(&csc[k].col_ptrs[col_idx], 1, __ATOMIC_RELAXED)] = row_idx;
+  }
+  return NULL;
+}
+
+// Orders node IDs for qsort.
+int compare_u32(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  return (x > y) - (x < y);
+}
+
+// Restores the pointers of the partitions binned by ingest_edges, and sorts the edges of each row and col, which
+// the threads binned in any order, until there is no partition left.
+void *sort_partitions(void *arg) {
+  struct convert_pool *pool = arg;
+  uint32_t i;
+  while ((i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED)) < pool->n) {
+    if (pool->csr) {
+      struct CSR *csr = &pool->csr[i];
+      restore_ptrs(csr->row_ptrs, csr->num_rows + 1);
+      for (uint32_t r = 0; r < csr->num_rows; ++r)
+        qsort(&csr->col_idxs[csr->row_ptrs[r]], csr->row_ptrs[r + 1] - csr->row_ptrs[r], sizeof(uint32_t), compare_u32);
+    }
+    if (pool->csc) {
+      struct CSC *csc = &pool->csc[i];
+      restore_ptrs(csc->col_ptrs, csc->num_cols + 1);
+      for (uint32_t c = 0; c < csc->num_cols; ++c)
+        qsort(&csc->row_idxs[csc->col_ptrs[c]], csc->col_ptrs[c + 1] - csc->col_ptrs[c], sizeof(uint32_t), compare_u32);
+    }
+  }
+  return NULL;
+}
+
+// Runs a pass of load_partitions over the chunks of the datafile, and reports its first malformed line.
+void run_ingest_chunks(struct datafile *df, struct ingest_chunk *chunks, void *(*fn)(void *)) {
+  pthread_t threads[num_threads];
+  for (uint32_t t = 0; t < num_threads; ++t)
+    pthread_create(&threads[t], NULL, fn, &chunks[t]);
+  for (uint32_t t = 0; t < num_threads; ++t)
+    pthread_join(threads[t], NULL);
+  check_lines(df);
+}
+
+/**
+ * @fn load_partitions
+ * @brief Loads the partitions of a datafile in the formats used by a BFS algorithm, without holding its whole edge
+ * list. Like partition_coo, then build_graph, but binning each edge of the datafile directly in its partitions:
+ * a pass over the datafile counts the edges of each partition, and of each of their rows and cols, then a second
+ * pass bins them. With balanced partitions, a first pass counts the edges of each block of nodes. The 2D grid is
+ * chosen, and the MRAM checked, from a sample of the datafile. The edges of the rows of the CSR partitions and of
+ * the cols of the CSC partitions are sorted, as they are in a sorted datafile.
+ * @param file the datafile.
+ * @param n the number of partitions.
+ * @param prt the partitioning.
+ * @param alg the BFS algorithm.
+ * @param padding the number of nodes added to pad the graph, set.
+ * @return the partitions, as build_graph makes them.
+ */
+struct Graph load_partitions(char *file, uint32_t n, enum Partition prt, enum Algorithm alg, uint32_t *padding) {
+  struct datafile df = map_datafile(file);
+  struct COO header = {.num_rows = df.num_nodes, .num_cols = df.num_nodes, .num_edges = df.num_edges};
+  *padding = pad_nodes(&header, balanced ? 1 : n);
+  uint32_t num_nodes = header.num_rows;
+  uint32_t offset = first_node(&df);
+  PRINT_INFO("%u nodes, %lu edges.", num_nodes, df.num_edges);
+
+  // Choose the grid from a sample of the datafile.
+  struct edge_sample sample = sample_datafile(&df, num_nodes, offset);
+  uint32_t row_div = prt == Row ? n : 1;
+  uint32_t col_div = prt == Col ? n : 1;
+  if (prt == _2D) {
+    choose_grid(&sample, n, alg);
+    grid_2d(n, &row_div, &col_div);
+  }
+  PRINT_INFO("Partitioning adjacency matrix into %u parts, while loading it.", n);
+
+  struct ingest_chunk chunks[num_threads];
+  for (uint32_t t = 0; t < num_threads; ++t)
+    chunks[t] = (struct ingest_chunk){.lines = &df.chunks[t], .prt = {.coo = &header, .col_div = col_div}, .offset = offset};
+
+  // Split the nodes, counting the edges of each block of rows and cols to balance them.
+  uint64_t *block_counts = NULL;
+  if (balanced) {
+    block_counts = calloc(2 * num_nodes / 32, sizeof(uint64_t));
+    for (uint32_t t = 0; t < num_threads; ++t)
+      chunks[t].prt.counts = block_counts;
+    run_ingest_chunks(&df, chunks, ingest_blocks);
+  }
+  row_starts = split_nodes(num_nodes, row_div, block_counts);
+  col_starts = split_nodes(num_nodes, col_div, block_counts ? &block_counts[num_nodes / 32] : NULL);
+  free(block_counts);
+
+  uint32_t *row_ranges = block_ranges(row_starts, row_div);
+  uint32_t *col_ranges = block_ranges(col_starts, col_div);
+  uint32_t num_rows = max_range(row_starts, row_div);
+  uint32_t num_cols = max_range(col_starts, col_div);
+
+  // The partitions of each format share arrays, as in build_graph. Pointers are allocated first, to count the edges
+  // of each row and col. Arrays have a spare word, as MRAM transfers of odd lengths read one word past the end.
+  uint32_t formats = graph_formats(alg);
+  struct Graph graph = {0};
+  if (formats & FormatCOO)
+    graph.coo = malloc(n * sizeof(struct COO));
+  if (formats & FormatCSR) {
+    graph.csr = malloc(n * sizeof(struct CSR));
+    uint32_t *ptrs = calloc((size_t)n * (num_rows + 1) + 1, sizeof(uint32_t));
+    for (uint32_t i = 0; i < n; ++i)
+      graph.csr[i] = (struct CSR){.num_rows = num_rows, .num_cols = num_cols, .row_ptrs = &ptrs[(size_t)i * (num_rows + 1)]};
+  }
+  if (formats & FormatCSC) {
+    graph.csc = malloc(n * sizeof(struct CSC));
+    uint32_t *ptrs = calloc((size_t)n * (num_cols + 1) + 1, sizeof(uint32_t));
+    for (uint32_t i = 0; i < n; ++i)
+      graph.csc[i] = (struct CSC){.num_rows = num_rows, .num_cols = num_cols, .col_ptrs = &ptrs[(size_t)i * (num_cols + 1)]};
+  }
+
+  // Count the edges of each chunk per partition, and of each row and col.
+  uint64_t *counts = calloc((size_t)num_threads * n, sizeof(uint64_t));
+  for (uint32_t t = 0; t < num_threads; ++t) {
+    chunks[t].prt.row_ranges = row_ranges;
+    chunks[t].prt.col_ranges = col_ranges;
+    chunks[t].prt.counts = &counts[(size_t)t * n];
+    chunks[t].graph = &graph;
+  }
+  run_ingest_chunks(&df, chunks, ingest_counts);
+
+  uint64_t max_edges = 0;
+  for (uint32_t k = 0; k < n; ++k) {
+    uint64_t edges = 0;
+    for (uint32_t t = 0; t < num_threads; ++t)
+      edges += counts[(size_t)t * n + k];
+    max_edges = edges > max_edges ? edges : max_edges;
+  }
+  PRINT_INFO("Partitions of %u x %u nodes. The largest has %lu edges, %.2fx the average.", num_rows, num_cols, max_edges,
+             df.num_edges ? (double)max_edges * n / df.num_edges : 1.0);
+  check_mram(&sample, alg, num_rows, num_cols, max_edges);
+  free(sample.coo->row_idxs);
+  free(sample.coo->col_idxs);
+  free(sample.coo);
+  free(sample.block_counts);
+
+  // Allocate the edges, and start the edges of each chunk after those of the previous chunks in each partition.
+  uint64_t num_edges = 0;
+  for (uint32_t k = 0; k < n; ++k)
+    for (uint32_t t = 0; t < num_threads; ++t)
+      num_edges += counts[(size_t)t * n + k];
+  size_t size = (num_edges + 1) * sizeof(uint32_t);
+  uint32_t *coo_rows = graph.coo ? malloc(size) : NULL;
+  uint32_t *coo_cols = graph.coo ? malloc(size) : NULL;
+  uint32_t *csr_cols = graph.csr ? malloc(size) : NULL;
+  uint32_t *csc_rows = graph.csc ? malloc(size) : NULL;
+  uint64_t edge_offset = 0;
+  for (uint32_t k = 0; k < n; ++k) {
+    uint64_t start = 0;
+    for (uint32_t t = 0; t < num_threads; ++t) {
+      uint64_t count = counts[(size_t)t * n + k];
+      counts[(size_t)t * n + k] = start;
+      start += count;
+    }
+    if (graph.coo)
+      graph.coo[k] = (struct COO){.num_rows = num_rows, .num_cols = num_cols, .num_edges = start,
+                                  .row_idxs = &coo_rows[edge_offset], .col_idxs = &coo_cols[edge_offset]};
+    if (graph.csr) {
+      graph.csr[k].num_edges = start;
+      graph.csr[k].col_idxs = &csr_cols[edge_offset];
+      prefix_sum_ptrs(graph.csr[k].row_ptrs, num_rows + 1);
+    }
+    if (graph.csc) {
+      graph.csc[k].num_edges = start;
+      graph.csc[k].row_idxs = &csc_rows[edge_offset];
+      prefix_sum_ptrs(graph.csc[k].col_ptrs, num_cols + 1);
+    }
+    edge_offset += start;
+  }
+
+  // Bin the edges, then restore the pointers and sort the edges of each row and col.
+  run_ingest_chunks(&df, chunks, ingest_edges);
+  if (graph.csr || graph.csc) {
+    struct convert_pool pool = {.csr = graph.csr, .csc = graph.csc, .n = n};
+    pthread_t threads[num_threads];
+    for (uint32_t t = 0; t < num_threads; ++t)
+      pthread_create(&threads[t], NULL, sort_partitions, &pool);
+    for (uint32_t t = 0; t < num_threads; ++t)
+      pthread_join(threads[t], NULL);
+  }
+
+  free(counts);
+  free(row_ranges);
+  free(col_ranges);
+  unmap_datafile(&df);
+  return graph;
+}
+
+// Frees the partitions of a graph.
+void free_graph(struct Graph graph) {
+  if (graph.map) {
+    free(graph.coo);
+    free(graph.csr);
+    free(graph.csc);
+    munmap(graph.map, graph.map_size);
+    return;
+  }
+
+  if (graph.coo)
+    free_coo_prts(graph.coo);
+  if (graph.csr)
+    free_csr_prts(graph.csr);
+  if (graph.csc)
+    free_csc_prts(graph.csc);
+}
+
+// Writes an array to a graph cache file, padded to 8 bytes.
+void write_cache_array(FILE *fp, uint32_t *array, uint32_t length) {
+  uint32_t zero = 0;
+  fwrite(array, sizeof(uint32_t), length, fp);
+  if (length % 2 != 0)
+    fwrite(&zero, sizeof(uint32_t), 1, fp);
+}
+
+/**
+ * @fn save_graph_cache
+ * @brief Saves the partitions of a graph to a binary graph cache file, which can replace the datafile in later runs.
+ * @param file the path of the graph cache file.
+ * @param graph the partitions of the graph.
+ * @param n the number of partitions.
+ * @param prt the partitioning of the graph.
+ * @param padding the number of nodes added by padding.
+ */
+void save_graph_cache(char *file, struct Graph graph, uint32_t n, enum Partition prt, uint32_t padding) {
+
+  FILE *fp = fopen(file, "wb");
+  if (fp == NULL) {
+    PRINT_ERROR("Could not create graph cache file %s.", file);
+    exit(1);
+  }
+  PRINT_INFO("Saving graph cache to %s.", file);
+
+  struct GraphCacheHeader header = {
+      .magic = GRAPH_CACHE_MAGIC,
+      .version = GRAPH_CACHE_VERSION,
+      .num_dpu = n,
+      .prt = prt,
+      .formats = (graph.coo ? FormatCOO : 0) | (graph.csr ? FormatCSR : 0) | (graph.csc ? FormatCSC : 0),
+      .padding = padding,
+      .order = new_ids ? order : OrderNone};
+
+  uint32_t *num_edges = malloc(n * sizeof(uint32_t));
+  for (uint32_t i = 0; i < n; ++i) {
+    if (graph.coo) {
+      header.num_rows = graph.coo[i].num_rows;
+      header.num_cols = graph.coo[i].num_cols;
+      num_edges[i] = graph.coo[i].num_edges;
+    } else if (graph.csr) {
+      header.num_rows = graph.csr[i].num_rows;
+      header.num_cols = graph.csr[i].num_cols;
+      num_edges[i] = graph.csr[i].num_edges;
+    } else {
+      header.num_rows = graph.csc[i].num_rows;
+      header.num_cols = graph.csc[i].num_cols;
+      num_edges[i] = graph.csc[i].num_edges;
+    }
+    header.num_edges += num_edges[i];
+  }
+
+  header.row_div = header.col_div = 1;
+  if (prt == Row)
+    header.row_div = n;
+  else if (prt == Col)
+    header.col_div = n;
+  else
+    grid_2d(n, &header.row_div, &header.col_div);
+
+  fwrite(&header, sizeof(struct GraphCacheHeader), 1, fp);
+  write_cache_array(fp, num_edges, n);
+  write_cache_array(fp, row_starts, header.row_div + 1);
+  write_cache_array(fp, col_starts, header.col_div + 1);
+  if (new_ids)
+    write_cache_array(fp, new_ids, row_starts[header.row_div]);
+  for (uint32_t i = 0; i < n; ++i) {
+    if (graph.coo) {
+      write_cache_array(fp, graph.coo[i].row_idxs, num_edges[i]);
+      write_cache_array(fp, graph.coo[i].col_idxs, num_edges[i]);
+    }
+    if (graph.csr) {
+      write_cache_array(fp, graph.csr[i].row_ptrs, header.num_rows + 1);
+      write_cache_array(fp, graph.csr[i].col_idxs, num_edges[i]);
+    }
+    if (graph.csc) {
+      write_cache_array(fp, graph.csc[i].col_ptrs, header.num_cols + 1);
+      write_cache_array(fp, graph.csc[i].row_idxs, num_edges[i]);
+    }
+  }
+
+  if (fclose(fp) != 0) {
+    PRINT_ERROR("Could not write graph cache file %s.", file);
+    exit(1);
+  }
+  free(num_edges);
+}
+
+// Returns whether a file is a graph cache file.
+bool is_graph_cache(char *file) {
+  char magic[8];
+  FILE *fp = fopen(file, "rb");
+  if (fp == NULL)
+    return false;
+  bool is_cache = fread(magic, 1, sizeof(magic), fp) == sizeof(magic) && memcmp(magic, GRAPH_CACHE_MAGIC, sizeof(magic)) == 0;
+  fclose(fp);
+  return is_cache;
+}
+
+// Returns the next array of a graph cache mapping, and advances *p past it.
+uint32_t *read_cache_array(uint8_t **p, uint32_t length) {
+  uint32_t *array = (uint32_t *)*p;
+  *p += ROUND_UP_TO_MULTIPLE((size_t)length * sizeof(uint32_t), 8);
+  return array;
+}
+
+/**
+ * @fn load_graph_cache
+ * @brief Maps a graph cache file. The partitions point into the mapping, so there is no parsing nor conversion.
+ * @param file the path of the graph cache file.
+ * @param n the number of partitions (DPUs).
+ * @param alg the BFS algorithm, that determines the formats needed.
+ * @param prt the partitioning of the graph.
+ */
+struct Graph load_graph_cache(char *file, uint32_t n, enum Algorithm alg, enum Partition prt) {
+
+  PRINT_INFO("Loading graph cache from %s.", file);
+
+  int fd = open(file, O_RDONLY);
+  struct stat st;
+  fstat(fd, &st);
+  size_t size = st.st_size;
+  if (size < sizeof(struct GraphCacheHeader)) {
+    PRINT_ERROR("Graph cache file %s is truncated.", file);
+    exit(1);
+  }
+  uint8_t *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    PRINT_ERROR("Could not map file %s.", file);
+    exit(1);
+  }
+
+  struct GraphCacheHeader header;
+  memcpy(&header, map, sizeof(struct GraphCacheHeader));
+  uint32_t formats = graph_formats(alg);
+  if (header.version != GRAPH_CACHE_VERSION) {
+    PRINT_ERROR("Graph cache file %s has version %u, expected %u.", file, header.version, GRAPH_CACHE_VERSION);
+    exit(1);
+  }
+  if (header.num_dpu != n || header.prt != (uint32_t)prt || (header.formats & formats) != formats) {
+    PRINT_ERROR("Graph cache file %s was saved for another number of DPUs, partitioning or algorithm.", file);
+    exit(1);
+  }
+
+  uint8_t *p = map + sizeof(struct GraphCacheHeader);
+  uint8_t *end = map + size;
+  uint32_t *num_edges = read_cache_array(&p, n);
+  uint32_t *starts[2] = {read_cache_array(&p, header.row_div + 1), read_cache_array(&p, header.col_div + 1)};
+  if (p > end || (header.order != OrderNone && p + ROUND_UP_TO_MULTIPLE((size_t)starts[0][header.row_div] * sizeof(uint32_t), 8) > end)) {
+    PRINT_ERROR("Graph cache file %s is truncated.", file);
+    exit(1);
+  }
+  if (prt == _2D) {
+    grid_row_div = header.row_div;
+    grid_col_div = header.col_div;
+  }
+  row_starts = malloc((header.row_div + 1) * sizeof(uint32_t));
+  col_starts = malloc((header.col_div + 1) * sizeof(uint32_t));
+  memcpy(row_starts, starts[0], (header.row_div + 1) * sizeof(uint32_t));
+  memcpy(col_starts, starts[1], (header.col_div + 1) * sizeof(uint32_t));
+  if (header.order != OrderNone) {
+    PRINT_INFO("Nodes were reordered when the cache was saved.");
+    uint32_t *ids = read_cache_array(&p, row_starts[header.row_div]);
+    new_ids = malloc(row_starts[header.row_div] * sizeof(uint32_t));
+    memcpy(new_ids, ids, row_starts[header.row_div] * sizeof(uint32_t));
+  }
+
+  if (header.padding != 0)
+    PRINT_WARNING("Padding number of nodes with %u extra nodes.", header.padding);
+  PRINT_INFO("%u nodes, %lu edges.", row_starts[header.row_div], header.num_edges);
+
+  struct Graph graph = {.map = map, .map_size = size};
+  if (header.formats & FormatCOO)
+    graph.coo = malloc(n * sizeof(struct COO));
+  if (header.formats & FormatCSR)
+    graph.csr = malloc(n * sizeof(struct CSR));
+  if (header.formats & FormatCSC)
+    graph.csc = malloc(n * sizeof(struct CSC));
+
+  for (uint32_t i = 0; i < n && p <= end; ++i) { // num_edges is in the mapping as long as p <= end.
+    uint32_t rows = header.num_rows;
+    uint32_t cols = header.num_cols;
+    uint32_t edges = num_edges[i];
+    if (graph.coo) {
+      graph.coo[i] = (struct COO){.num_rows = rows, .num_cols = cols, .num_edges = edges};
+      graph.coo[i].row_idxs = read_cache_array(&p, edges);
+      graph.coo[i].col_idxs = read_cache_array(&p, edges);
+    }
+    if (graph.csr) {
+      graph.csr[i] = (struct CSR){.num_rows = rows, .num_cols = cols, .num_edges = edges};
+      graph.csr[i].row_ptrs = read_cache_array(&p, rows + 1);
+      graph.csr[i].col_idxs = read_cache_array(&p, edges);
+    }
+    if (graph.csc) {
+      graph.csc[i] = (struct CSC){.num_rows = rows, .num_cols = cols, .num_edges = edges};
+      graph.csc[i].col_ptrs = read_cache_array(&p, cols + 1);
+      graph.csc[i].row_idxs = read_cache_array(&p, edges);
+    }
+  }
+  if (p > end) {
+    PRINT_ERROR("Graph cache file %s is truncated.", file);
+    exit(1);
+  }
+
+  return graph;
+}
+
+// Sets the options given as auto to those a graph cache was saved with. The algorithm is the one using its formats.
+void cache_config(char *file, uint32_t *n, enum Algorithm *alg, enum Partition *prt) {
+  struct GraphCacheHeader header;
+  FILE *fp = fopen(file, "rb");
+  if (fp == NULL || fread(&header, sizeof(struct GraphCacheHeader), 1, fp) != 1) {
+    PRINT_ERROR("Graph cache file %s is truncated.", file);
+    exit(1);
+  }
+  fclose(fp);
+
+  if (auto_dpu)
+    *n = header.num_dpu;
+  if (auto_prt)
+    *prt = header.prt;
+  if (auto_alg) {
+    if (header.formats & FormatCOO)
+      *alg = Edge;
+    else if ((header.formats & FormatCSR) && (header.formats & FormatCSC) && !multi_source)
+      *alg = Hybrid;
+    else
+      *alg = header.formats & FormatCSR ? TopDown : BottomUp;
+  }
+  print_config("Graph cache", *n, *alg, *prt);
+}
+
+// Starts the hybrid BFS from root top-down.
+void reset_direction(uint32_t root) {
+  direction.edges_to_check = direction.num_edges - direction.degrees[root];
+  direction.frontier_size = 1;
+  direction.mode = TopDown;
+  dpu_set_u32(set, "mode", direction.mode);
+}
+
+/**
+ * @fn next_direction
+ * @brief Chooses the direction of the next level of a direction-optimizing BFS, and records it in direction.
+ * Switches to bottom-up when the edges out of the frontier exceed 1/HYBRID_ALPHA of the edges left to check,
+ * and back to top-down when the frontier shrinks below 1/HYBRID_BETA of the nodes (Beamer et al.).
+ * @param frontier_size the number of nodes in the next frontier.
+ * @param frontier_edges the number of edges out of the nodes of the next frontier.
+ * @return whether the direction changed.
+ */
+bool next_direction(uint32_t frontier_size, uint64_t frontier_edges) {
+  direction.edges_to_check -= frontier_edges;
+
+  enum Algorithm mode = direction.mode;
+  if (mode == TopDown && frontier_edges > direction.edges_to_check / HYBRID_ALPHA)
+    mode = BottomUp;
+  else if (mode == BottomUp && frontier_size < direction.frontier_size && frontier_size < direction.num_nodes / HYBRID_BETA)
+    mode = TopDown;
+  direction.frontier_size = frontier_size;
+
+  bool changed = mode != direction.mode;
+  direction.mode = mode;
+  return changed;
+}
+
+// Chooses the direction of the next level of the hybrid BFS from its next frontier (of the whole graph), and sends
+// it to the DPUs if it changed.
+void update_direction(uint32_t *frontier, uint32_t len_frontier) {
+  uint32_t frontier_size = 0;
+  uint64_t frontier_edges = 0;
+  for (uint32_t w = 0; w < len_frontier; ++w) {
+    uint32_t word = frontier[w];
+    if (word == 0)
+      continue;
+    frontier_size += __builtin_popcount(word);
+    for (uint32_t b = 0; b < 32; ++b)
+      if (word & (1u << b))
+        frontier_edges += direction.degrees[w * 32 + b];
+  }
+  if (next_direction(frontier_size, frontier_edges))
+    dpu_set_u32(set, "mode", direction.mode);
+}
+
+// Records the level of the nodes of the next frontier of a multi-source BFS, for each source.
+void record_levels(uint32_t *frontier, uint32_t len_frontier, uint32_t level) {
+  for (uint32_t node = 0; node < len_frontier; ++node)
+    for (uint32_t srcs = frontier[node]; srcs != 0; srcs &= srcs - 1)
+      ms_levels[__builtin_ctz(srcs) * len_frontier + node] = level;
+}
+
+// ORs len words of src into dst, with the widest vectors available.
+static inline void or_words(uint32_t *restrict dst, const uint32_t *restrict src, uint32_t len) {
+  uint32_t w = 0;
+#if defined(__AVX512F__)
+  for (; w + 16 <= len; w += 16)
+    _mm512_storeu_si512(&dst[w], _mm512_or_si512(_mm512_loadu_si512(&dst[w]), _mm512_loadu_si512(&src[w])));
+#elif defined(__AVX2__)
+  for (; w + 8 <= len; w += 8)
+    _mm256_storeu_si256((__m256i *)&dst[w], _mm256_or_si256(_mm256_loadu_si256((__m256i *)&dst[w]), _mm256_loadu_si256((const __m256i *)&src[w])));
+#endif
+  for (; w < len; ++w)
+    dst[w] |= src[w];
 }
 
-// Frees CSC matrix.
-void free_csc(struct CSC csc) {
-  free(csc.col_ptrs);
-  free(csc.row_idxs);
+// Range of frontier words merged by a reduction thread.
+struct reduce_chunk {
+  uint32_t *frontier;    // Frontier of the whole graph.
+  uint32_t *nf_tmp;      // Next frontiers of the DPUs, stride words apart.
+  uint32_t stride;       // Distance between the next frontiers of nf_tmp.
+  uint32_t *updated;     // DPUs that updated their next frontier.
+  uint32_t num_updated;  // Number of updated DPUs.
+  uint32_t len_nf;       // Length of the next frontier of a DPU.
+  uint32_t col_div;      // Number of DPUs per row of the adjacency matrix.
+  uint32_t len_frontier; // Length of frontier.
+  uint32_t from;         // First word of the range.
+  uint32_t to;           // One past the last word of the range.
+  uint64_t bits;         // Number of bits set in the range after the merge.
+};
+
+// Merges the part of each updated next frontier that falls in a range of the frontier, then counts its bits.
+void *reduce_range(void *arg) {
+  struct reduce_chunk *chunk = arg;
+  for (uint32_t u = 0; u < chunk->num_updated; ++u) {
+    uint32_t d = chunk->updated[u];
+    uint32_t start = col_starts[d % chunk->col_div] / nodes_per_word;
+    uint32_t from = start > chunk->from ? start : chunk->from;
+    uint32_t to = start + chunk->len_nf < chunk->to ? start + chunk->len_nf : chunk->to;
+    if (from < to)
+      or_words(&chunk->frontier[from], &chunk->nf_tmp[(size_t)d * chunk->stride + from - start], to - from);
+  }
+
+  chunk->bits = 0;
+  for (uint32_t w = chunk->from; w < chunk->to; ++w)
+    chunk->bits += __builtin_popcount(chunk->frontier[w]);
+  return NULL;
+}
+
+/**
+ * @fn reduce_frontiers
+ * @brief ORs the next frontiers of the DPUs into the frontier of the whole graph. The next frontier of DPU d lands
+ * at the start of its cols, col_starts[d % col_div], so the DPUs of a row partitioning share the whole frontier, and
+ * the DPUs of a 2D partitioning share the slice of their column. Next frontiers that run past the end of the graph
+ * (past the cols of the last DPUs) are cut. DPUs that did not update their next frontier are skipped.
+ * The frontier is split in ranges of at least REDUCE_GRAIN words, merged by up to num_threads threads.
+ * @param frontier the frontier of the whole graph, already cleared.
+ * @param nf_tmp the next frontiers fetched from the DPUs.
+ * @param stride the distance between the next frontiers of nf_tmp, at least len_nf.
+ * @param mailboxes the mailbox of each DPU.
+ * @param len_nf the length of the next frontier of a DPU.
+ * @param col_div the number of DPUs per row of the adjacency matrix.
+ * @param len_frontier the length of frontier.
+ * @return the number of bits set in frontier.
+ */
+uint64_t reduce_frontiers(uint32_t *frontier, uint32_t *nf_tmp, uint32_t stride, struct mailbox *mailboxes, uint32_t len_nf, uint32_t col_div, uint32_t len_frontier) {
+
+  uint32_t updated[num_dpu];
+  uint32_t num_updated = 0;
+  for (uint32_t d = 0; d < num_dpu; ++d)
+    if (mailboxes[d].nf_updated == 1)
+      updated[num_updated++] = d;
+
+  uint32_t n = len_frontier / REDUCE_GRAIN;
+  n = n < 1 ? 1 : n > num_threads ? num_threads : n;
+  struct reduce_chunk chunks[n];
+  pthread_t threads[n];
+  for (uint32_t t = 0; t < n; ++t) {
+    chunks[t] = (struct reduce_chunk){
+        .frontier = frontier,
+        .nf_tmp = nf_tmp,
+        .stride = stride,
+        .updated = updated,
+        .num_updated = num_updated,
+        .len_nf = len_nf,
+        .col_div = col_div,
+        .len_frontier = len_frontier,
+        .from = (uint64_t)len_frontier * t / n,
+        .to = (uint64_t)len_frontier * (t + 1) / n};
+    if (t > 0)
+      pthread_create(&threads[t], NULL, reduce_range, &chunks[t]);
+  }
+  reduce_range(&chunks[0]);
+
+  uint64_t bits = chunks[0].bits;
+  for (uint32_t t = 1; t < n; ++t) {
+    pthread_join(threads[t], NULL);
+    bits += chunks[t].bits;
+  }
+  return bits;
 }
 
-// Prints the number of cycles of the worst performing DPU in the set.
+// Prints the number of cycles of the worst performing DPU in the set, followed by the avg cycles of its tasklets.
 void print_dpu_cycles(struct dpu_set_t set, struct dpu_set_t dpu) {
   uint64_t cycles[num_dpu][NR_TASKLETS];
   uint32_t i = 0;
@@ -553,30 +2942,58 @@ void print_dpu_cycles(struct dpu_set_t set, struct dpu_set_t dpu) {
   }
   DPU_ASSERT(dpu_push_xfer(set, DPU_XFER_FROM_DPU, "cycles", 0, sizeof(uint64_t) * NR_TASKLETS, DPU_XFER_DEFAULT));
 
-  // Get max cycles per DPU (among tasklets).
+  // Get max and avg cycles per DPU (among tasklets).
   uint64_t max_dpu_cycles[num_dpu];
+  uint64_t avg_dpu_cycles[num_dpu];
   DPU_FOREACH(set, dpu, i) {
-    uint32_t max = 0;
+    uint64_t max = 0;
+    uint64_t sum = 0;
     for (uint32_t t = 0; t < NR_TASKLETS; t++) {
       uint64_t tasklet_cycles = cycles[i][t];
       if (tasklet_cycles > max)
         max = tasklet_cycles;
+      sum += tasklet_cycles;
     }
     max_dpu_cycles[i] = max;
+    avg_dpu_cycles[i] = sum / NR_TASKLETS;
   }
 
-  // Get avg and max DPU cycles per level (i.e. worst-performing DPU).
+  // Get max DPU cycles per level (i.e. worst-performing DPU), and the avg tasklet cycles of that DPU.
   uint64_t max_cycles_lvl = 0;
+  uint64_t avg_cycles_lvl = 0;
   for (uint32_t d = 0; d < num_dpu; ++d) {
     uint64_t max_dpu = max_dpu_cycles[d];
-    if (max_dpu > max_cycles_lvl)
+    if (max_dpu > max_cycles_lvl) {
       max_cycles_lvl = max_dpu;
+      avg_cycles_lvl = avg_dpu_cycles[d];
+    }
   }
-  printf("%lu\n", max_cycles_lvl);
+  printf("%lu %lu\n", max_cycles_lvl, avg_cycles_lvl);
 }
 
-// Fetches and prints node levels from DPUs.
-void print_node_levels(uint32_t total_nodes, uint32_t len_nl, uint32_t div) {
+// Prints the level of each node reached from a root, by their IDs in the datafile. The levels are indexed by the IDs
+// of the nodes in the partitions, and are 0 for the nodes that are not reached.
+void write_node_levels(uint32_t *node_levels, uint32_t total_nodes, uint32_t root) {
+  for (uint32_t node = 0; node < total_nodes; ++node) {
+    uint32_t level = node_levels[new_ids ? new_ids[node] : node];
+    if (node != root && level == 0) // Filters out "padded" rows.
+      continue;
+    fprintf(out, "%u\t%u\n", node, level);
+  }
+}
+
+/**
+ * @fn print_node_levels
+ * @brief Fetches and prints node levels from DPUs. DPUs whose node_levels cover the same nodes (including the nodes
+ * past the end of their ranges) have the same levels for them.
+ * @param total_nodes the number of nodes of the whole graph.
+ * @param len_nl the length of node_levels of a DPU.
+ * @param starts the node ranges of the node_levels of the DPUs (row_starts or col_starts).
+ * @param div DPU i has the node_levels of range i / div % mod.
+ * @param mod the number of ranges.
+ * @param root the root of the BFS.
+ */
+void print_node_levels(uint32_t total_nodes, uint32_t len_nl, uint32_t *starts, uint32_t div, uint32_t mod, uint32_t root) {
   fprintf(out, "node\tlevel\n");
 
 #if BENCHMARK_TIME
@@ -589,25 +3006,20 @@ void print_node_levels(uint32_t total_nodes, uint32_t len_nl, uint32_t div) {
   uint32_t i = 0;
   DPU_FOREACH(set, dpu, i) {
     dpu_get_mram_array_u32(dpu, "node_levels", nl_tmp, len_nl);
-    for (uint32_t n = 0; n < len_nl; ++n) {
-      uint32_t nreal = n + i / div * len_nl % total_nodes;
-      if (node_levels[nreal] == 0 || nl_tmp[n] < node_levels[nreal])
+    uint32_t start = starts[i / div % mod];
+    for (uint32_t n = 0; n < len_nl && start + n < total_nodes; ++n) {
+      uint32_t nreal = start + n;
+      if (nl_tmp[n] != 0 && (node_levels[nreal] == 0 || nl_tmp[n] < node_levels[nreal]))
         node_levels[nreal] = nl_tmp[n];
     }
   }
 
 #if BENCHMARK_TIME
   stop_time(&fetch_res_timer);
-  fetch_res_time = get_elapsed_time(fetch_res_timer);
+  fetch_res_time += get_elapsed_time(fetch_res_timer);
 #endif
 
-  for (uint32_t node = 0; node < total_nodes; ++node) {
-    uint32_t level = node_levels[node];
-    if (node != 0 && level == 0) // Filters out "padded" rows.
-      continue;
-    fprintf(out, "%u\t%u\n", node, node_levels[node]);
-  }
-
+  write_node_levels(node_levels, total_nodes, root);
   free(nl_tmp);
   free(node_levels);
 }
@@ -615,13 +3027,13 @@ void print_node_levels(uint32_t total_nodes, uint32_t len_nl, uint32_t div) {
 void start_row(uint32_t len_cf, uint32_t len_nf) {
 
   uint32_t size_nf = ROUND_UP_TO_MULTIPLE(len_nf * sizeof(uint32_t), 8);
-  uint32_t size_cf = ROUND_UP_TO_MULTIPLE(len_cf * sizeof(uint32_t), 8);
-  uint32_t size_nf_tmp = size_nf * num_dpu;
+  size_t size_nf_tmp = (size_t)size_nf * num_dpu;
+  uint32_t stride_nf = size_nf / sizeof(uint32_t);
 
-  uint32_t *frontier = calloc(size_nf, 1);
+  // The rows of the last DPU may run past the end of the graph, where the frontier stays clear.
+  uint32_t *frontier = calloc(size_nf + ROUND_UP_TO_MULTIPLE(len_cf * sizeof(uint32_t), 8), 1);
   uint32_t *nf_tmp = calloc(size_nf_tmp, 1);
-  uint32_t *nf_updated = calloc(num_dpu, sizeof(uint32_t));
-  uint32_t level = 0;
+  struct mailbox *mailboxes = calloc(num_dpu, sizeof(struct mailbox));
   bool done = true;
 
   while (true) {
@@ -631,7 +3043,8 @@ void start_row(uint32_t len_cf, uint32_t len_nf) {
 #endif
 
     // Launch DPUs.
-    DPU_ASSERT(dpu_launch(set, DPU_SYNCHRONOUS));
+    launch_level();
+    num_levels++;
 
 #if BENCHMARK_TIME
     stop_time(&dpu_compute_timer);
@@ -642,14 +3055,14 @@ void start_row(uint32_t len_cf, uint32_t len_nf) {
     uint32_t i = 0;
     // Check which DPUs updated their next frontiers.
     DPU_FOREACH(set, dpu, i) {
-      DPU_ASSERT(dpu_prepare_xfer(dpu, &nf_updated[i]));
+      DPU_ASSERT(dpu_prepare_xfer(dpu, &mailboxes[i]));
     }
-    DPU_ASSERT(dpu_push_xfer_symbol(set, DPU_XFER_FROM_DPU, nf_updated_sym, 0, sizeof(uint32_t), DPU_XFER_DEFAULT));
+    DPU_ASSERT(dpu_push_xfer_symbol(set, DPU_XFER_FROM_DPU, mailbox_sym, 0, sizeof(struct mailbox), DPU_XFER_DEFAULT));
 
     // Fetch next_frontiers.
     DPU_FOREACH(set, dpu, i) {
-      if (nf_updated[i] == 1) {
-        DPU_ASSERT(dpu_prepare_xfer(dpu, &nf_tmp[i * len_nf]));
+      if (mailboxes[i].nf_updated == 1) {
+        DPU_ASSERT(dpu_prepare_xfer(dpu, &nf_tmp[(size_t)i * stride_nf]));
         done = false;
       }
     }
@@ -662,9 +3075,7 @@ void start_row(uint32_t len_cf, uint32_t len_nf) {
 #endif
 
     // Union next_frontiers.
-    for (uint32_t d = 0; d < num_dpu; ++d)
-      for (uint32_t c = 0; c < len_nf; ++c)
-        frontier[c] |= nf_tmp[d * len_nf + c];
+    frontier_bits += reduce_frontiers(frontier, nf_tmp, stride_nf, mailboxes, len_nf, 1, len_nf);
 
 #if BENCHMARK_TIME
     stop_time(&host_aggr_timer);
@@ -679,19 +3090,18 @@ void start_row(uint32_t len_cf, uint32_t len_nf) {
       break;
     done = true;
 
-    // Update level, next_frontier and current_frontier.
-    ++level;
-    DPU_ASSERT(dpu_copy_to_symbol(set, level_sym, 0, &level, sizeof(uint32_t)));
-    DPU_ASSERT(dpu_prepare_xfer(set, frontier));
-    DPU_ASSERT(dpu_push_xfer_symbol(set, DPU_XFER_TO_DPU, mram_heap_sym, nf_addr, size_nf, DPU_XFER_DEFAULT));
-    DPU_FOREACH(set, dpu, i) {
-      DPU_ASSERT(dpu_prepare_xfer(dpu, &frontier[i * len_cf]));
-    }
-    DPU_ASSERT(dpu_push_xfer_symbol(set, DPU_XFER_TO_DPU, mram_heap_sym, cf_addr, size_cf, DPU_XFER_DEFAULT));
+    if (direction.degrees)
+      update_direction(frontier, len_nf);
+    if (ms_levels)
+      record_levels(frontier, len_nf, mailboxes[0].level);
 
-    // Clear frontier.
+    // Update next_frontier and current_frontier. DPUs already advanced their level.
+    push_frontier(frontier, len_nf, col_starts, 1, 1, nf_addr, nf_inbox_addr);
+    push_frontier(frontier, len_cf, row_starts, 1, num_dpu, cf_addr, cf_inbox_addr);
+    activate_segments(frontier, row_starts, num_dpu);
+
+    // Clear frontier. nf_tmp is only read where the DPUs updated it.
     memset(frontier, 0, size_nf);
-    memset(nf_tmp, 0, size_nf_tmp);
 
 #if BENCHMARK_TIME
     stop_time(&host_comm_timer);
@@ -699,7 +3109,7 @@ void start_row(uint32_t len_cf, uint32_t len_nf) {
 #endif
   }
 
-  free(nf_updated);
+  free(mailboxes);
   free(nf_tmp);
   free(frontier);
 }
@@ -708,11 +3118,19 @@ void start_col(uint32_t len_cf, uint32_t len_nf) {
 
   uint32_t size_nf = ROUND_UP_TO_MULTIPLE(len_nf * sizeof(uint32_t), 8);
   uint32_t size_cf = ROUND_UP_TO_MULTIPLE(len_cf * sizeof(uint32_t), 8);
-  uint32_t *nf_updated = calloc(num_dpu, sizeof(uint32_t));
+  struct mailbox *mailboxes = calloc(num_dpu, sizeof(struct mailbox));
   uint32_t *frontier = calloc(size_cf, 1);
-  uint32_t level = 0;
   bool done = true;
 
+  // Next frontiers are gathered in place when their transfers are exactly len_nf long, and the cols of DPU d start at
+  // word d * len_nf. Otherwise the transfers would overlap (8 bytes transfers, or cols that are balanced by edges,
+  // see partition_coo), so they are gathered in nf_tmp and then merged.
+  uint32_t stride_nf = size_nf / sizeof(uint32_t);
+  bool in_place = stride_nf == len_nf;
+  for (uint32_t d = 0; d < num_dpu; ++d)
+    in_place = in_place && col_starts[d] / nodes_per_word == d * len_nf;
+  uint32_t *nf_tmp = in_place ? frontier : calloc(num_dpu, size_nf);
+
   while (true) {
 
 #if BENCHMARK_TIME
@@ -720,7 +3138,8 @@ void start_col(uint32_t len_cf, uint32_t len_nf) {
 #endif
 
     // Launch DPUs.
-    DPU_ASSERT(dpu_launch(set, DPU_SYNCHRONOUS));
+    launch_level();
+    num_levels++;
 
 #if BENCHMARK_TIME
     stop_time(&dpu_compute_timer);
@@ -731,18 +3150,22 @@ void start_col(uint32_t len_cf, uint32_t len_nf) {
     uint32_t i = 0;
     // Check which DPUs updated their next frontiers.
     DPU_FOREACH(set, dpu, i) {
-      DPU_ASSERT(dpu_prepare_xfer(dpu, &nf_updated[i]));
+      DPU_ASSERT(dpu_prepare_xfer(dpu, &mailboxes[i]));
     }
-    DPU_ASSERT(dpu_push_xfer_symbol(set, DPU_XFER_FROM_DPU, nf_updated_sym, 0, sizeof(uint32_t), DPU_XFER_DEFAULT));
+    DPU_ASSERT(dpu_push_xfer_symbol(set, DPU_XFER_FROM_DPU, mailbox_sym, 0, sizeof(struct mailbox), DPU_XFER_DEFAULT));
 
-    // Concatenate all next_frontiers.
+    // Concatenate all next_frontiers, in a single transfer from the DPUs that updated theirs. The others are skipped.
     DPU_FOREACH(set, dpu, i) {
-      if (nf_updated[i] == 1) {
+      if (mailboxes[i].nf_updated == 1) {
         done = false;
-        DPU_ASSERT(dpu_prepare_xfer(dpu, &frontier[i * len_nf]));
-        DPU_ASSERT(dpu_push_xfer_symbol(dpu, DPU_XFER_FROM_DPU, mram_heap_sym, nf_addr, size_nf, DPU_XFER_DEFAULT));
+        DPU_ASSERT(dpu_prepare_xfer(dpu, &nf_tmp[(size_t)i * stride_nf]));
       }
     }
+    if (!done) {
+      DPU_ASSERT(dpu_push_xfer_symbol(set, DPU_XFER_FROM_DPU, mram_heap_sym, nf_addr, size_nf, DPU_XFER_DEFAULT));
+      if (!in_place)
+        reduce_frontiers(frontier, nf_tmp, stride_nf, mailboxes, len_nf, num_dpu, len_cf);
+    }
 
 #if BENCHMARK_CYCLES
     print_dpu_cycles(set, dpu);
@@ -752,11 +3175,14 @@ void start_col(uint32_t len_cf, uint32_t len_nf) {
       break;
     done = true;
 
-    // Update level and curr_frontier of DPUs.
-    ++level;
-    DPU_ASSERT(dpu_copy_to_symbol(set, level_sym, 0, &level, sizeof(uint32_t)));
-    DPU_ASSERT(dpu_prepare_xfer(set, frontier));
-    DPU_ASSERT(dpu_push_xfer_symbol(set, DPU_XFER_TO_DPU, mram_heap_sym, cf_addr, size_cf, DPU_XFER_DEFAULT));
+    if (direction.degrees)
+      update_direction(frontier, len_cf);
+    if (ms_levels)
+      record_levels(frontier, len_cf, mailboxes[0].level);
+
+    // Update curr_frontier of DPUs. DPUs already advanced their level.
+    push_frontier(frontier, len_cf, row_starts, 1, 1, cf_addr, cf_inbox_addr);
+    activate_segments(frontier, row_starts, 1);
 
     memset(frontier, 0, size_cf);
 #if BENCHMARK_TIME
@@ -765,21 +3191,23 @@ void start_col(uint32_t len_cf, uint32_t len_nf) {
 #endif
   }
 
-  free(nf_updated);
+  if (!in_place)
+    free(nf_tmp);
+  free(mailboxes);
   free(frontier);
 }
 
 void start_2d(uint32_t len_frontier, uint32_t len_cf, uint32_t len_nf, uint32_t col_div) {
 
   uint32_t size_nf = ROUND_UP_TO_MULTIPLE(len_nf * sizeof(uint32_t), 8);
-  uint32_t size_cf = ROUND_UP_TO_MULTIPLE(len_cf * sizeof(uint32_t), 8);
   uint32_t size_f = ROUND_UP_TO_MULTIPLE(len_frontier * sizeof(uint32_t), 8);
-  uint32_t size_nf_tmp = size_nf * num_dpu;
+  size_t size_nf_tmp = (size_t)size_nf * num_dpu;
+  uint32_t stride_nf = size_nf / sizeof(uint32_t);
 
-  uint32_t *frontier = calloc(size_f, 1);
+  // The rows and cols of the last DPUs may run past the end of the graph, where the frontier stays clear.
+  uint32_t *frontier = calloc(size_f + ROUND_UP_TO_MULTIPLE((len_cf > len_nf ? len_cf : len_nf) * sizeof(uint32_t), 8), 1);
   uint32_t *nf_tmp = calloc(size_nf_tmp, 1);
-  uint32_t *nf_updated = calloc(num_dpu, sizeof(uint32_t));
-  uint32_t level = 0;
+  struct mailbox *mailboxes = calloc(num_dpu, sizeof(struct mailbox));
 
   while (true) {
 
@@ -788,7 +3216,8 @@ void start_2d(uint32_t len_frontier, uint32_t len_cf, uint32_t len_nf, uint32_t
 #endif
 
     // Launch DPUs.
-    DPU_ASSERT(dpu_launch(set, DPU_SYNCHRONOUS));
+    launch_level();
+    num_levels++;
 
 #if BENCHMARK_TIME
     stop_time(&dpu_compute_timer);
@@ -799,16 +3228,16 @@ void start_2d(uint32_t len_frontier, uint32_t len_cf, uint32_t len_nf, uint32_t
     // Check which DPUs updated their next frontiers.
     uint32_t i = 0;
     DPU_FOREACH(set, dpu, i) {
-      DPU_ASSERT(dpu_prepare_xfer(dpu, &nf_updated[i]));
+      DPU_ASSERT(dpu_prepare_xfer(dpu, &mailboxes[i]));
     }
-    DPU_ASSERT(dpu_push_xfer_symbol(set, DPU_XFER_FROM_DPU, nf_updated_sym, 0, sizeof(uint32_t), DPU_XFER_DEFAULT));
+    DPU_ASSERT(dpu_push_xfer_symbol(set, DPU_XFER_FROM_DPU, mailbox_sym, 0, sizeof(struct mailbox), DPU_XFER_DEFAULT));
 
     // Fetch next_frontiers and count updated nf.
     uint32_t num_updated_dpus = 0;
     DPU_FOREACH(set, dpu, i) {
-      if (nf_updated[i] == 1) {
+      if (mailboxes[i].nf_updated == 1) {
         num_updated_dpus++;
-        DPU_ASSERT(dpu_prepare_xfer(dpu, &nf_tmp[i * len_nf]));
+        DPU_ASSERT(dpu_prepare_xfer(dpu, &nf_tmp[(size_t)i * stride_nf]));
       }
     }
     if (num_updated_dpus == 0)
@@ -821,12 +3250,8 @@ void start_2d(uint32_t len_frontier, uint32_t len_cf, uint32_t len_nf, uint32_t
     start_time(&host_aggr_timer);
 #endif
 
-    // Concatenate by column and union by row the next_frontiers of each DPU, and check if done.
-    DPU_FOREACH(set, dpu, i) {
-      if (nf_updated[i] == true)
-        for (uint32_t c = 0; c < len_nf; ++c)
-          frontier[i * len_nf % len_frontier + c] |= nf_tmp[i * len_nf + c];
-    }
+    // Concatenate by column and union by row the next_frontiers of each DPU.
+    frontier_bits += reduce_frontiers(frontier, nf_tmp, stride_nf, mailboxes, len_nf, col_div, len_frontier);
 #if BENCHMARK_TIME
     stop_time(&host_aggr_timer);
     host_aggr_time += get_elapsed_time(host_aggr_timer);
@@ -836,17 +3261,15 @@ void start_2d(uint32_t len_frontier, uint32_t len_cf, uint32_t len_nf, uint32_t
     print_dpu_cycles(set, dpu);
 #endif
 
-    // Update level, next_frontier and current_frontier.
-    ++level;
-    DPU_ASSERT(dpu_copy_to_symbol(set, level_sym, 0, &level, sizeof(uint32_t)));
-    DPU_FOREACH(set, dpu, i) {
-      DPU_ASSERT(dpu_prepare_xfer(dpu, &frontier[i * len_nf % len_frontier]));
-    }
-    DPU_ASSERT(dpu_push_xfer_symbol(set, DPU_XFER_TO_DPU, mram_heap_sym, nf_addr, size_nf, DPU_XFER_DEFAULT));
-    DPU_FOREACH(set, dpu, i) {
-      DPU_ASSERT(dpu_prepare_xfer(dpu, &frontier[i / col_div * len_cf]));
-    }
-    DPU_ASSERT(dpu_push_xfer_symbol(set, DPU_XFER_TO_DPU, mram_heap_sym, cf_addr, size_cf, DPU_XFER_DEFAULT));
+    if (direction.degrees)
+      update_direction(frontier, len_frontier);
+    if (ms_levels)
+      record_levels(frontier, len_frontier, mailboxes[0].level);
+
+    // Update next_frontier and current_frontier. DPUs already advanced their level.
+    push_frontier(frontier, len_nf, col_starts, 1, col_div, nf_addr, nf_inbox_addr);
+    push_frontier(frontier, len_cf, row_starts, col_div, num_dpu / col_div, cf_addr, cf_inbox_addr);
+    activate_segments(frontier, row_starts, num_dpu / col_div);
 
     // Clear frontier.
     memset(frontier, 0, size_f);
@@ -857,25 +3280,227 @@ void start_2d(uint32_t len_frontier, uint32_t len_cf, uint32_t len_nf, uint32_t
 #endif
   }
 
-  free(nf_updated);
+  free(mailboxes);
   free(nf_tmp);
   free(frontier);
 }
 
-void bfs_top_down(struct COO *coo, int num_dpu, enum Partition prt) {
+// Opens the output file of a root: <out_path>.<root> for roots files, out_path otherwise.
+void open_output(uint32_t root) {
+  if (batch && strcmp(out_path, "/dev/null") != 0) {
+    char path[strlen(out_path) + 12];
+    sprintf(path, "%s.%u", out_path, root);
+    out = fopen(path, "w");
+  } else
+    out = fopen(out_path, "w");
+}
 
-  // Convert COO partitions to CSR.
-  struct CSR *csr = malloc(num_dpu * sizeof(struct CSR));
-  for (int i = 0; i < num_dpu; ++i) {
-    csr[i] = coo_to_csr(coo[i]);
-    free_coo(coo[i]);
+/**
+ * @fn ms_bfs_roots
+ * @brief Runs a multi-source BFS for each batch of MS_SOURCES roots on the graph already populated in MRAM,
+ * and prints node levels of each root. Only visited, the frontiers and the mailbox are reset between batches.
+ * @param prt the partitioning of the graph.
+ * @param total_nodes the number of nodes of the whole graph.
+ * @param len_cf the length of curr_frontier of a DPU.
+ * @param len_nf the length of next_frontier of a DPU.
+ * @param col_div the number of DPUs per row of the adjacency matrix.
+ */
+void ms_bfs_roots(enum Partition prt, uint32_t total_nodes, uint32_t len_cf, uint32_t len_nf, uint32_t col_div) {
+
+  uint32_t lcf = ROUND_UP_TO_MULTIPLE(len_cf, BLOCK_SIZE);
+  uint32_t lnf = ROUND_UP_TO_MULTIPLE(len_nf, BLOCK_SIZE);
+
+  uint32_t *frontier = calloc(total_nodes + (lcf > lnf ? lcf : lnf), sizeof(uint32_t)); // Margin for the slices of the last DPUs.
+  uint32_t *vis = malloc(lnf * sizeof(uint32_t));
+  ms_levels = malloc((size_t)MS_SOURCES * total_nodes * sizeof(uint32_t));
+
+  for (uint32_t first = 0; first < num_roots; first += MS_SOURCES) {
+    uint32_t num_srcs = num_roots - first < MS_SOURCES ? num_roots - first : MS_SOURCES;
+    uint32_t *srcs = &roots[first];
+    for (uint32_t s = 0; s < num_srcs; ++s)
+      if (srcs[s] >= total_nodes) {
+        PRINT_ERROR("Root %u is not a node of the graph.", srcs[s]);
+        exit(1);
+      }
+
+#if BENCHMARK_TIME
+    double dpu_compute_start = dpu_compute_time;
+    double host_comm_start = host_comm_time;
+    double host_aggr_start = host_aggr_time;
+    start_time(&host_comm_timer);
+#endif
+
+    // Reset BFS data. Sources that are not part of the batch are visited everywhere, so they never expand.
+    struct mailbox mailbox = {.level = 0, .nf_updated = 0};
+    DPU_ASSERT(dpu_copy_to_symbol(set, mailbox_sym, 0, &mailbox, sizeof(struct mailbox)));
+    memset(ms_levels, 0, (size_t)MS_SOURCES * total_nodes * sizeof(uint32_t));
+
+    uint32_t batch_mask = num_srcs == 32 ? UINT32_MAX : (1u << num_srcs) - 1;
+    for (uint32_t n = 0; n < lnf; ++n)
+      vis[n] = ~batch_mask;
+    DPU_ASSERT(dpu_prepare_xfer(set, vis));
+    DPU_ASSERT(dpu_push_xfer_symbol(set, DPU_XFER_TO_DPU, mram_heap_sym, vis_addr, lnf * sizeof(uint32_t), DPU_XFER_DEFAULT));
+
+    // Add each root node to cf and nf of the DPUs whose rows and cols contain it, with the bit of its source.
+    for (uint32_t s = 0; s < num_srcs; ++s)
+      frontier[new_ids ? new_ids[srcs[s]] : srcs[s]] |= 1u << s;
+    uint32_t i = 0;
+    DPU_FOREACH(set, dpu, i) {
+      DPU_ASSERT(dpu_prepare_xfer(dpu, &frontier[col_starts[i % col_div] / nodes_per_word]));
+    }
+    DPU_ASSERT(dpu_push_xfer_symbol(set, DPU_XFER_TO_DPU, mram_heap_sym, nf_addr, lnf * sizeof(uint32_t), DPU_XFER_DEFAULT));
+    DPU_FOREACH(set, dpu, i) {
+      DPU_ASSERT(dpu_prepare_xfer(dpu, &frontier[row_starts[i / col_div] / nodes_per_word]));
+    }
+    DPU_ASSERT(dpu_push_xfer_symbol(set, DPU_XFER_TO_DPU, mram_heap_sym, cf_addr, lcf * sizeof(uint32_t), DPU_XFER_DEFAULT));
+    for (uint32_t s = 0; s < num_srcs; ++s)
+      frontier[new_ids ? new_ids[srcs[s]] : srcs[s]] = 0;
+
+#if BENCHMARK_TIME
+    stop_time(&host_comm_timer);
+    host_comm_time += get_elapsed_time(host_comm_timer);
+#endif
+
+    // Start BFS algorithm.
+    PRINT_INFO("Starting multi-source BFS algorithm from %u roots.", num_srcs);
+    if (prt == Row)
+      start_row(len_cf, len_nf);
+    else if (prt == Col)
+      start_col(len_cf, len_nf);
+    else
+      start_2d(total_nodes, len_cf, len_nf, col_div);
+
+    // Print node levels of each root.
+    for (uint32_t s = 0; s < num_srcs; ++s) {
+      open_output(srcs[s]);
+      fprintf(out, "node\tlevel\n");
+      write_node_levels(&ms_levels[s * total_nodes], total_nodes, srcs[s]);
+      fclose(out);
+    }
+
+#if BENCHMARK_TIME
+    if (batch)
+      printf("batch %u num_roots %u dpu_compute_time %f host_comm_time %f host_aggr_time %f total_alg %f\n", first / MS_SOURCES, num_srcs,
+             dpu_compute_time - dpu_compute_start, host_comm_time - host_comm_start, host_aggr_time - host_aggr_start,
+             dpu_compute_time + host_comm_time + host_aggr_time - dpu_compute_start - host_comm_start - host_aggr_start);
+#endif
+  }
+
+  free(ms_levels);
+  ms_levels = 0;
+  free(vis);
+  free(frontier);
+}
+
+/**
+ * @fn bfs_roots
+ * @brief Runs the BFS from each root on the graph already populated in MRAM, and prints node levels of each root.
+ * Only visited, the frontiers, node_levels and the mailbox are reset between roots.
+ * @param prt the partitioning of the graph.
+ * @param total_nodes the number of nodes of the whole graph.
+ * @param len_cf the length of curr_frontier of a DPU.
+ * @param len_nf the length of next_frontier of a DPU.
+ * @param len_nl the length of node_levels of a DPU.
+ * @param col_div the number of DPUs per row of the adjacency matrix.
+ * @param nl_rows whether node_levels of a DPU covers its rows (curr_frontier), rather than its cols (next_frontier).
+ */
+void bfs_roots(enum Partition prt, uint32_t total_nodes, uint32_t len_cf, uint32_t len_nf, uint32_t len_nl, uint32_t col_div, bool nl_rows) {
+
+  if (multi_source) {
+    ms_bfs_roots(prt, total_nodes, len_cf, len_nf, col_div);
+    return;
+  }
+
+  uint32_t len_frontier = total_nodes / 32;
+  uint32_t lcf = ROUND_UP_TO_MULTIPLE(len_cf, BLOCK_SIZE);
+  uint32_t lnf = ROUND_UP_TO_MULTIPLE(len_nf, BLOCK_SIZE);
+  uint32_t lnl = ROUND_UP_TO_MULTIPLE(len_nl, BLOCK_SIZE);
+
+  uint32_t *frontier = calloc(len_frontier + (lcf > lnf ? lcf : lnf), sizeof(uint32_t)); // Margin for the slices of the last DPUs.
+  uint32_t *zeros = calloc(lnf > lnl ? lnf : lnl, sizeof(uint32_t));
+
+  for (uint32_t r = 0; r < num_roots; ++r) {
+    uint32_t root = roots[r];
+    if (root >= total_nodes) {
+      PRINT_ERROR("Root %u is not a node of the graph.", root);
+      exit(1);
+    }
+    uint32_t node = new_ids ? new_ids[root] : root; // ID of the root on the DPUs.
+
+    open_output(root);
+
+#if BENCHMARK_TIME
+    double dpu_compute_start = dpu_compute_time;
+    double host_comm_start = host_comm_time;
+    double host_aggr_start = host_aggr_time;
+    start_time(&host_comm_timer);
+#endif
+
+    // Reset BFS data.
+    struct mailbox mailbox = {.level = 0, .nf_updated = 0};
+    DPU_ASSERT(dpu_copy_to_symbol(set, mailbox_sym, 0, &mailbox, sizeof(struct mailbox)));
+    if (direction.degrees)
+      reset_direction(node);
+
+    DPU_ASSERT(dpu_prepare_xfer(set, zeros));
+    DPU_ASSERT(dpu_push_xfer_symbol(set, DPU_XFER_TO_DPU, mram_heap_sym, vis_addr, lnf * sizeof(uint32_t), DPU_XFER_DEFAULT));
+    DPU_ASSERT(dpu_prepare_xfer(set, zeros));
+    DPU_ASSERT(dpu_push_xfer_symbol(set, DPU_XFER_TO_DPU, mram_heap_sym, nl_addr, lnl * sizeof(uint32_t), DPU_XFER_DEFAULT));
+
+    // Add root node to cf and nf of the DPUs whose rows and cols contain it.
+    frontier[node / 32] = 1u << node % 32;
+    uint32_t i = 0;
+    DPU_FOREACH(set, dpu, i) {
+      DPU_ASSERT(dpu_prepare_xfer(dpu, &frontier[col_starts[i % col_div] / nodes_per_word]));
+    }
+    DPU_ASSERT(dpu_push_xfer_symbol(set, DPU_XFER_TO_DPU, mram_heap_sym, nf_addr, lnf * sizeof(uint32_t), DPU_XFER_DEFAULT));
+    DPU_FOREACH(set, dpu, i) {
+      DPU_ASSERT(dpu_prepare_xfer(dpu, &frontier[row_starts[i / col_div] / nodes_per_word]));
+    }
+    DPU_ASSERT(dpu_push_xfer_symbol(set, DPU_XFER_TO_DPU, mram_heap_sym, cf_addr, lcf * sizeof(uint32_t), DPU_XFER_DEFAULT));
+    activate_segments(frontier, row_starts, num_dpu / col_div);
+    frontier[node / 32] = 0;
+
+#if BENCHMARK_TIME
+    stop_time(&host_comm_timer);
+    host_comm_time += get_elapsed_time(host_comm_timer);
+#endif
+
+    // Start BFS algorithm.
+    PRINT_INFO("Starting BFS algorithm from root %u.", root);
+    if (prt == Row)
+      start_row(len_cf, len_nf);
+    else if (prt == Col)
+      start_col(len_cf, len_nf);
+    else
+      start_2d(len_frontier, len_cf, len_nf, col_div);
+
+    // Print node levels.
+    if (nl_rows)
+      print_node_levels(total_nodes, len_nl, row_starts, col_div, num_dpu / col_div, root);
+    else
+      print_node_levels(total_nodes, len_nl, col_starts, 1, col_div, root);
+    fclose(out);
+
+#if BENCHMARK_TIME
+    if (batch)
+      printf("root %u dpu_compute_time %f host_comm_time %f host_aggr_time %f total_alg %f\n", root,
+             dpu_compute_time - dpu_compute_start, host_comm_time - host_comm_start, host_aggr_time - host_aggr_start,
+             dpu_compute_time + host_comm_time + host_aggr_time - dpu_compute_start - host_comm_start - host_aggr_start);
+#endif
   }
 
+  free(zeros);
+  free(frontier);
+}
+
+void bfs_top_down(struct CSR *csr, int num_dpu, enum Partition prt) {
+
   // Compute BFS metadata.
   uint32_t num_nodes = csr[0].num_rows;
   uint32_t num_neighbors = csr[0].num_cols;
-  uint32_t len_cf = num_nodes / 32;
-  uint32_t len_nf = num_neighbors / 32;
+  uint32_t len_cf = num_nodes / nodes_per_word;
+  uint32_t len_nf = num_neighbors / nodes_per_word;
   uint32_t total_nodes, len_nl;
   uint32_t row_div = 1, col_div = 1;
 
@@ -888,15 +3513,11 @@ void bfs_top_down(struct COO *coo, int num_dpu, enum Partition prt) {
     total_nodes = num_nodes;
     len_nl = num_nodes;
   } else {
-    nearest_factors(num_dpu, &row_div, &col_div);
-    total_nodes = num_nodes * num_dpu / col_div;
+    grid_2d(num_dpu, &row_div, &col_div);
+    total_nodes = row_starts[row_div];
     len_nl = num_nodes;
   }
 
-  uint32_t len_frontier = total_nodes / 32;
-  uint32_t *frontier = calloc(len_frontier + BLOCK_SIZE, sizeof(uint32_t)); // +BLOCK_SIZE for safe margin of copy.
-  frontier[0] = 1;                                                          // Set root node.
-
   // Copy data to MRAM.
   PRINT_INFO("Populating MRAM.");
 
@@ -904,76 +3525,50 @@ void bfs_top_down(struct COO *coo, int num_dpu, enum Partition prt) {
   start_time(&pop_mram_timer);
 #endif
 
-  uint32_t i = 0;
-  DPU_FOREACH(set, dpu, i) {
-
-    // Copy BFS data.
-    dpu_set_u32(dpu, "level", 0);
-    dpu_set_u32(dpu, "len_nf", len_nf);
-    dpu_set_u32(dpu, "len_cf", len_cf);
-
-    // Add root node to cf of all DPUs of first row and to nf of all DPUs of first col.
-    uint32_t *cf = i < col_div ? frontier : 0;
-    uint32_t *nf = i % col_div == 0 ? frontier : 0;
-
-    // Make sure arrays can be safely partitioned by NR_TASKLETS and BLOCK_SIZE.
-    uint32_t lcf = ROUND_UP_TO_MULTIPLE(len_cf, BLOCK_SIZE);
-    uint32_t lnf = ROUND_UP_TO_MULTIPLE(len_nf, BLOCK_SIZE);
-    uint32_t lnl = ROUND_UP_TO_MULTIPLE(len_nl, BLOCK_SIZE);
-
-    dpu_insert_mram_array_u32(dpu, "visited", 0, lnf);
-    dpu_insert_mram_array_u32(dpu, "next_frontier", nf, lnf);
-    dpu_insert_mram_array_u32(dpu, "curr_frontier", cf, lcf);
-    dpu_insert_mram_array_u32(dpu, "node_levels", 0, lnl);
-
-    // Copy CSR data. Variable sized buffers must be copied last.
-    dpu_insert_mram_array_u32(dpu, "node_ptrs", csr[i].row_ptrs, num_nodes + 1);
-    dpu_insert_mram_array_u32(dpu, "edges", csr[i].col_idxs, csr[i].num_edges);
-
-    // Cache some MRAM addresses (address must be the same for all DPUs).
-    DPU_ASSERT(dpu_copy_from(dpu, "next_frontier", 0, &nf_addr, sizeof(mram_addr_t)));
-    DPU_ASSERT(dpu_copy_from(dpu, "curr_frontier", 0, &cf_addr, sizeof(mram_addr_t)));
-
-    // PRINT_DEBUG("DPU %d populated with %ld MB", i, (lnf + lnf + lcf + lnl + num_nodes + 1 + csr[i].num_edges) * sizeof(uint32_t) / 1048576);
+  // Plan the MRAM layout, then copy CSR data with parallel transfers.
+  plan_bfs_data(len_cf, len_nf, len_nl);
+  uint32_t **srcs = malloc(num_dpu * sizeof(uint32_t *));
+  uint32_t *lengths = malloc(num_dpu * sizeof(uint32_t));
+  for (int i = 0; i < num_dpu; ++i) {
+    srcs[i] = csr[i].row_ptrs;
+    lengths[i] = num_nodes + 1;
+  }
+  populate_partitions("node_ptrs", srcs, lengths);
+  uint64_t max_edges = 0;
+  for (int i = 0; i < num_dpu; ++i) {
+    srcs[i] = csr[i].col_idxs;
+    lengths[i] = csr[i].num_edges;
+    max_edges = csr[i].num_edges > max_edges ? csr[i].num_edges : max_edges;
   }
 
+  // Stream the edges through the rest of MRAM if they do not fit.
+  uint32_t window = mram_plan_end < MRAM_SIZE ? (MRAM_SIZE - mram_plan_end) / sizeof(uint32_t) & ~1u : 0;
+  if (mram_plan_end + mram_array_size(max_edges) > MRAM_SIZE && !multi_source && window > 0) {
+    streaming.addr = dpu_plan_mram_array_u32("edges", window);
+    plan_segments(csr, len_cf, window);
+    PRINT_INFO("Streaming the edges in %u segments of up to %u edges.", streaming.num_segments, window);
+  } else
+    populate_partitions("edges", srcs, lengths);
+  free(srcs);
+  free(lengths);
+
 #if BENCHMARK_TIME
   stop_time(&pop_mram_timer);
   pop_mram_time = get_elapsed_time(pop_mram_timer);
 #endif
 
-  // Free resources.
-  free(frontier);
-  for (int i = 0; i < num_dpu; ++i)
-    free_csr(csr[i]);
-
-  // Start BFS algorithm.
-  PRINT_INFO("Starting BFS algorithm.");
-  if (prt == Row)
-    start_row(len_cf, len_nf);
-  else if (prt == Col)
-    start_col(len_cf, len_nf);
-  else
-    start_2d(len_frontier, len_cf, len_nf, col_div);
-
-  // Print node levels.
-  print_node_levels(total_nodes, len_nl, col_div);
+  // Run the BFS from each root.
+  bfs_roots(prt, total_nodes, len_cf, len_nf, len_nl, col_div, true);
+  stop_streaming();
 }
 
-void bfs_bottom_up(struct COO *coo, int num_dpu, enum Partition prt) {
-
-  // Convert COO partitions to CSC.
-  struct CSC *csc = malloc(num_dpu * sizeof(struct CSC));
-  for (int i = 0; i < num_dpu; ++i) {
-    csc[i] = coo_to_csc(coo[i]);
-    free_coo(coo[i]);
-  }
+void bfs_bottom_up(struct CSC *csc, int num_dpu, enum Partition prt) {
 
   // Compute BFS metadata.
   uint32_t num_nodes = csc[0].num_rows;
   uint32_t num_neighbors = csc[0].num_cols;
-  uint32_t len_cf = num_nodes / 32;
-  uint32_t len_nf = num_neighbors / 32;
+  uint32_t len_cf = num_nodes / nodes_per_word;
+  uint32_t len_nf = num_neighbors / nodes_per_word;
   uint32_t total_nodes, len_nl;
   uint32_t row_div = 1, col_div = 1;
 
@@ -986,15 +3581,11 @@ void bfs_bottom_up(struct COO *coo, int num_dpu, enum Partition prt) {
     total_nodes = num_nodes;
     len_nl = num_neighbors;
   } else {
-    nearest_factors(num_dpu, &row_div, &col_div);
-    total_nodes = num_nodes * num_dpu / col_div;
+    grid_2d(num_dpu, &row_div, &col_div);
+    total_nodes = row_starts[row_div];
     len_nl = num_neighbors;
   }
 
-  uint32_t len_frontier = total_nodes / 32;
-  uint32_t *frontier = calloc(len_frontier + BLOCK_SIZE, sizeof(uint32_t)); // +BLOCK_SIZE for safe margin of copy.
-  frontier[0] = 1;                                                          // Set root node.
-
   // Copy data to MRAM.
   PRINT_INFO("Populating MRAM.");
 
@@ -1002,66 +3593,97 @@ void bfs_bottom_up(struct COO *coo, int num_dpu, enum Partition prt) {
   start_time(&pop_mram_timer);
 #endif
 
-  uint32_t i = 0;
-  DPU_FOREACH(set, dpu, i) {
+  // Plan the MRAM layout, then copy CSC data with parallel transfers.
+  plan_bfs_data(len_cf, len_nf, len_nl);
+  uint32_t **srcs = malloc(num_dpu * sizeof(uint32_t *));
+  uint32_t *lengths = malloc(num_dpu * sizeof(uint32_t));
+  for (int i = 0; i < num_dpu; ++i) {
+    srcs[i] = csc[i].col_ptrs;
+    lengths[i] = num_neighbors + 1;
+  }
+  populate_partitions("node_ptrs", srcs, lengths);
+  for (int i = 0; i < num_dpu; ++i) {
+    srcs[i] = csc[i].row_idxs;
+    lengths[i] = csc[i].num_edges;
+  }
+  populate_partitions("edges", srcs, lengths);
+  free(srcs);
+  free(lengths);
+
+#if BENCHMARK_TIME
+  stop_time(&pop_mram_timer);
+  pop_mram_time = get_elapsed_time(pop_mram_timer);
+#endif
 
-    // Copy BFS data.
-    dpu_set_u32(dpu, "level", 0);
-    dpu_set_u32(dpu, "len_nf", len_nf);
+  // Run the BFS from each root.
+  bfs_roots(prt, total_nodes, len_cf, len_nf, len_nl, col_div, false);
+}
 
-    // Make sure arrays can be safely partitioned by NR_TASKLETS and BLOCK_SIZE.
-    uint32_t lcf = ROUND_UP_TO_MULTIPLE(len_cf, BLOCK_SIZE);
-    uint32_t lnf = ROUND_UP_TO_MULTIPLE(len_nf, BLOCK_SIZE);
-    uint32_t lnl = ROUND_UP_TO_MULTIPLE(len_nl, BLOCK_SIZE);
+void bfs_edge(struct COO *coo, int num_dpu, enum Partition prt) {
 
-    // Add root node to cf of all DPUs of first row and to nf of all DPUs of first col.
-    uint32_t *cf = i < col_div ? frontier : 0;
-    uint32_t *nf = i % col_div == 0 ? frontier : 0;
+  // Compute BFS metadata.
+  uint32_t num_nodes = coo[0].num_rows;
+  uint32_t num_neighbors = coo[0].num_cols;
+  uint32_t len_cf = num_nodes / nodes_per_word;
+  uint32_t len_nf = num_neighbors / nodes_per_word;
+  uint32_t total_nodes, len_nl;
+  uint32_t row_div = 1, col_div = 1;
 
-    dpu_insert_mram_array_u32(dpu, "visited", 0, lnf);
-    dpu_insert_mram_array_u32(dpu, "next_frontier", nf, lnf);
-    dpu_insert_mram_array_u32(dpu, "curr_frontier", cf, lcf);
-    dpu_insert_mram_array_u32(dpu, "node_levels", 0, lnl);
+  if (prt == Row) {
+    row_div = num_dpu;
+    total_nodes = num_neighbors;
+    len_nl = num_neighbors;
+  } else if (prt == Col) {
+    col_div = num_dpu;
+    total_nodes = num_nodes;
+    len_nl = num_neighbors;
+  } else {
+    grid_2d(num_dpu, &row_div, &col_div);
+    total_nodes = row_starts[row_div];
+    len_nl = num_neighbors;
+  }
 
-    // Copy CSR data. Variable sized buffers must be copied last.
-    dpu_insert_mram_array_u32(dpu, "node_ptrs", csc[i].col_ptrs, num_neighbors + 1);
-    dpu_insert_mram_array_u32(dpu, "edges", csc[i].row_idxs, csc[i].num_edges);
+  // Copy data to MRAM.
+  PRINT_INFO("Populating MRAM.");
 
-    // Cache some MRAM addresses (address must be the same for all DPUs).
-    DPU_ASSERT(dpu_copy_from(dpu, "next_frontier", 0, &nf_addr, sizeof(mram_addr_t)));
-    DPU_ASSERT(dpu_copy_from(dpu, "curr_frontier", 0, &cf_addr, sizeof(mram_addr_t)));
+#if BENCHMARK_TIME
+  start_time(&pop_mram_timer);
+#endif
 
-    // PRINT_DEBUG("DPU %d populated with %ld MB", i, (lnf + lnf + lcf + lnl + num_neighbors + 1 + csc[i].num_edges) * sizeof(uint32_t) / 1048576);
+  // Plan the MRAM layout, then copy COO data with parallel transfers.
+  plan_bfs_data(len_cf, len_nf, len_nl);
+  uint32_t **srcs = malloc(num_dpu * sizeof(uint32_t *));
+  uint32_t *lengths = malloc(num_dpu * sizeof(uint32_t));
+  for (int i = 0; i < num_dpu; ++i) {
+    srcs[i] = coo[i].row_idxs;
+    lengths[i] = coo[i].num_edges;
+  }
+  uint32_t i = 0;
+  DPU_FOREACH(set, dpu, i) {
+    DPU_ASSERT(dpu_prepare_xfer(dpu, &lengths[i]));
   }
+  DPU_ASSERT(dpu_push_xfer(set, DPU_XFER_TO_DPU, "num_edges", 0, sizeof(uint32_t), DPU_XFER_DEFAULT));
+  populate_partitions("nodes", srcs, lengths);
+  for (int i = 0; i < num_dpu; ++i)
+    srcs[i] = coo[i].col_idxs;
+  populate_partitions("neighbors", srcs, lengths);
+  free(srcs);
+  free(lengths);
 
 #if BENCHMARK_TIME
   stop_time(&pop_mram_timer);
   pop_mram_time = get_elapsed_time(pop_mram_timer);
 #endif
 
-  // Free resources.
-  free(frontier);
-  for (int i = 0; i < num_dpu; ++i)
-    free_csc(csc[i]);
-
-  // Start BFS algorithm.
-  PRINT_INFO("Starting BFS algorithm.");
-  if (prt == Row)
-    start_row(len_cf, len_nf);
-  else if (prt == Col)
-    start_col(len_cf, len_nf);
-  else
-    start_2d(len_frontier, len_cf, len_nf, col_div);
-
-  // Print node levels.
-  print_node_levels(total_nodes, len_nl, 1);
+  // Run the BFS from each root.
+  bfs_roots(prt, total_nodes, len_cf, len_nf, len_nl, col_div, false);
 }
 
-void bfs_edge(struct COO *coo, int num_dpu, enum Partition prt) {
+void bfs_hybrid(struct CSR *csr, struct CSC *csc, int num_dpu, enum Partition prt) {
 
   // Compute BFS metadata.
-  uint32_t num_nodes = coo[0].num_rows;
-  uint32_t num_neighbors = coo[0].num_cols;
+  uint32_t num_nodes = csr[0].num_rows;
+  uint32_t num_neighbors = csr[0].num_cols;
   uint32_t len_cf = num_nodes / 32;
   uint32_t len_nf = num_neighbors / 32;
   uint32_t total_nodes, len_nl;
@@ -1076,14 +3698,17 @@ void bfs_edge(struct COO *coo, int num_dpu, enum Partition prt) {
     total_nodes = num_nodes;
     len_nl = num_neighbors;
   } else {
-    nearest_factors(num_dpu, &row_div, &col_div);
-    total_nodes = num_nodes * num_dpu / col_div;
+    grid_2d(num_dpu, &row_div, &col_div);
+    total_nodes = row_starts[row_div];
     len_nl = num_neighbors;
   }
 
-  uint32_t len_frontier = total_nodes / 32;
-  uint32_t *frontier = calloc(len_frontier + BLOCK_SIZE, sizeof(uint32_t)); // +BLOCK_SIZE for safe margin of copy.
-  frontier[0] = 1;                                                          // Set root node.
+  // Direction state, reset for each root by reset_direction.
+  direction.degrees = out_degrees(csr, num_dpu, col_div, total_nodes);
+  direction.num_nodes = total_nodes;
+  direction.num_edges = 0;
+  for (uint32_t n = 0; n < total_nodes; ++n)
+    direction.num_edges += direction.degrees[n];
 
   // Copy data to MRAM.
   PRINT_INFO("Populating MRAM.");
@@ -1092,100 +3717,366 @@ void bfs_edge(struct COO *coo, int num_dpu, enum Partition prt) {
   start_time(&pop_mram_timer);
 #endif
 
-  uint32_t i = 0;
-  DPU_FOREACH(set, dpu, i) {
+  // Plan the MRAM layout, then copy CSR and CSC data with parallel transfers.
+  plan_bfs_data(len_cf, len_nf, len_nl);
+  uint32_t **srcs = malloc(num_dpu * sizeof(uint32_t *));
+  uint32_t *lengths = malloc(num_dpu * sizeof(uint32_t));
+  for (int i = 0; i < num_dpu; ++i) {
+    srcs[i] = csr[i].row_ptrs;
+    lengths[i] = num_nodes + 1;
+  }
+  populate_partitions("node_ptrs", srcs, lengths);
+  for (int i = 0; i < num_dpu; ++i) {
+    srcs[i] = csr[i].col_idxs;
+    lengths[i] = csr[i].num_edges;
+  }
+  populate_partitions("edges", srcs, lengths);
+  for (int i = 0; i < num_dpu; ++i) {
+    srcs[i] = csc[i].col_ptrs;
+    lengths[i] = num_neighbors + 1;
+  }
+  populate_partitions("in_node_ptrs", srcs, lengths);
+  for (int i = 0; i < num_dpu; ++i) {
+    srcs[i] = csc[i].row_idxs;
+    lengths[i] = csc[i].num_edges;
+  }
+  populate_partitions("in_edges", srcs, lengths);
+  free(srcs);
+  free(lengths);
+
+#if BENCHMARK_TIME
+  stop_time(&pop_mram_timer);
+  pop_mram_time = get_elapsed_time(pop_mram_timer);
+#endif
 
-    // Copy BFS data.
-    dpu_set_u32(dpu, "level", 0);
-    dpu_set_u32(dpu, "len_nf", len_nf);
+  // Run the BFS from each root.
+  bfs_roots(prt, total_nodes, len_cf, len_nf, len_nl, col_div, false);
+
+  free(direction.degrees);
+  direction.degrees = 0;
+}
 
-    // Add root node to cf of all DPUs of first row and to nf of all DPUs of first col.
-    uint32_t *cf = i < col_div ? frontier : 0;
-    uint32_t *nf = i % col_div == 0 ? frontier : 0;
+// State of the host BFS, shared by its threads (see bfs_cpu).
+struct cpu_bfs {
+  struct CSR *csr;            // Out-edges of the whole graph.
+  struct CSC *csc;            // In-edges of the whole graph.
+  uint32_t len_frontier;      // Length of the bitmaps.
+  uint32_t *visited;          // Visited nodes.
+  uint32_t *curr_frontier;    // Nodes of the current level.
+  uint32_t *next_frontier;    // Nodes of the next level.
+  uint32_t *node_levels;      // Level of each node, or 0 if it is not reached (yet).
+  uint32_t level;             // Level of the nodes of curr_frontier.
+  bool done;                  // Whether the next frontier is empty.
+  uint32_t next_word;         // Next word of the bitmaps handed out to a thread.
+  uint32_t *frontier_sizes;   // Number of nodes added to the next frontier by each thread.
+  uint64_t *frontier_edges;   // Number of edges out of these nodes, for each thread.
+  pthread_barrier_t barrier;  // Barrier between the steps of a level.
+};
 
-    // Make sure arrays can be safely partitioned by NR_TASKLETS and BLOCK_SIZE.
-    uint32_t lcf = ROUND_UP_TO_MULTIPLE(len_cf, BLOCK_SIZE);
-    uint32_t lnf = ROUND_UP_TO_MULTIPLE(len_nf, BLOCK_SIZE);
-    uint32_t lnl = ROUND_UP_TO_MULTIPLE(len_nl, BLOCK_SIZE);
+// Thread of the host BFS.
+struct cpu_worker {
+  struct cpu_bfs *bfs;
+  uint32_t id;
+};
 
-    dpu_insert_mram_array_u32(dpu, "visited", 0, lnf);
-    dpu_insert_mram_array_u32(dpu, "next_frontier", nf, lnf);
-    dpu_insert_mram_array_u32(dpu, "curr_frontier", cf, lcf);
-    dpu_insert_mram_array_u32(dpu, "node_levels", 0, lnl);
+// Expands the nodes of the current frontier in words [first, last) to their unvisited out-neighbors.
+static void cpu_top_down(struct cpu_bfs *bfs, uint32_t id, uint32_t first, uint32_t last) {
+  uint32_t *row_ptrs = bfs->csr->row_ptrs;
+  uint32_t *col_idxs = bfs->csr->col_idxs;
+  for (uint32_t w = first; w < last; ++w)
+    for (uint32_t word = bfs->curr_frontier[w]; word != 0; word &= word - 1) {
+      uint32_t node = w * 32 + __builtin_ctz(word);
+      for (uint32_t e = row_ptrs[node]; e < row_ptrs[node + 1]; ++e) {
+        uint32_t neighbor = col_idxs[e];
+        uint32_t bit = 1u << neighbor % 32;
+        if (__atomic_load_n(&bfs->visited[neighbor / 32], __ATOMIC_RELAXED) & bit)
+          continue;
+        if (__atomic_fetch_or(&bfs->visited[neighbor / 32], bit, __ATOMIC_RELAXED) & bit)
+          continue; // Claimed by another thread.
+        __atomic_fetch_or(&bfs->next_frontier[neighbor / 32], bit, __ATOMIC_RELAXED);
+        bfs->node_levels[neighbor] = bfs->level + 1;
+        bfs->frontier_sizes[id]++;
+        bfs->frontier_edges[id] += row_ptrs[neighbor + 1] - row_ptrs[neighbor];
+      }
+    }
+}
 
-    // Copy COO data. Variable sized buffers must be copied last.
-    uint32_t num_edges = coo[i].num_edges;
-    dpu_set_u32(dpu, "num_edges", num_edges);
-    dpu_insert_mram_array_u32(dpu, "nodes", coo[i].row_idxs, num_edges);
-    dpu_insert_mram_array_u32(dpu, "neighbors", coo[i].col_idxs, num_edges);
+// Looks for a parent in the current frontier for each unvisited node in words [first, last). The thread owns
+// these words of visited and of the next frontier for the level.
+static void cpu_bottom_up(struct cpu_bfs *bfs, uint32_t id, uint32_t first, uint32_t last) {
+  uint32_t *col_ptrs = bfs->csc->col_ptrs;
+  uint32_t *row_idxs = bfs->csc->row_idxs;
+  uint32_t *row_ptrs = bfs->csr->row_ptrs;
+  for (uint32_t w = first; w < last; ++w) {
+    uint32_t found = 0;
+    for (uint32_t word = ~bfs->visited[w]; word != 0; word &= word - 1) {
+      uint32_t node = w * 32 + __builtin_ctz(word);
+      for (uint32_t e = col_ptrs[node]; e < col_ptrs[node + 1]; ++e) {
+        uint32_t parent = row_idxs[e];
+        if (bfs->curr_frontier[parent / 32] & (1u << parent % 32)) {
+          found |= 1u << node % 32;
+          bfs->node_levels[node] = bfs->level + 1;
+          bfs->frontier_edges[id] += row_ptrs[node + 1] - row_ptrs[node];
+          break;
+        }
+      }
+    }
+    bfs->visited[w] |= found;
+    bfs->next_frontier[w] = found;
+    bfs->frontier_sizes[id] += __builtin_popcount(found);
+  }
+}
 
-    // Cache some MRAM addresses (address must be the same for all DPUs).
-    DPU_ASSERT(dpu_copy_from(dpu, "next_frontier", 0, &nf_addr, sizeof(mram_addr_t)));
-    DPU_ASSERT(dpu_copy_from(dpu, "curr_frontier", 0, &cf_addr, sizeof(mram_addr_t)));
+// Runs the levels of a BFS. The words of the bitmaps are handed out CPU_GRAIN at a time, and the last thread to
+// finish a level chooses the direction of the next one.
+void *cpu_levels(void *arg) {
+  struct cpu_worker *worker = arg;
+  struct cpu_bfs *bfs = worker->bfs;
+  uint32_t len = bfs->len_frontier;
+  uint32_t slice = (len + num_threads - 1) / num_threads;
+  uint32_t from = worker->id * slice < len ? worker->id * slice : len;
+  uint32_t to = from + slice < len ? from + slice : len;
+
+  while (!bfs->done) {
+    // Clear the slice of the thread of the next frontier (the previous current frontier).
+    memset(&bfs->next_frontier[from], 0, (to - from) * sizeof(uint32_t));
+    bfs->frontier_sizes[worker->id] = 0;
+    bfs->frontier_edges[worker->id] = 0;
+    pthread_barrier_wait(&bfs->barrier);
+
+    uint32_t first;
+    while ((first = __atomic_fetch_add(&bfs->next_word, CPU_GRAIN, __ATOMIC_RELAXED)) < len) {
+      uint32_t last = first + CPU_GRAIN < len ? first + CPU_GRAIN : len;
+      if (direction.mode == TopDown)
+        cpu_top_down(bfs, worker->id, first, last);
+      else
+        cpu_bottom_up(bfs, worker->id, first, last);
+    }
 
-    // PRINT_DEBUG("DPU %d populated with %ld MB", i, (lnf + lnf + lcf + lnl + num_edges + num_edges) * sizeof(uint32_t) / 1048576);
+    if (pthread_barrier_wait(&bfs->barrier) == PTHREAD_BARRIER_SERIAL_THREAD) {
+      uint32_t frontier_size = 0;
+      uint64_t frontier_edges = 0;
+      for (uint32_t t = 0; t < num_threads; ++t) {
+        frontier_size += bfs->frontier_sizes[t];
+        frontier_edges += bfs->frontier_edges[t];
+      }
+      next_direction(frontier_size, frontier_edges);
+      uint32_t *frontier = bfs->curr_frontier;
+      bfs->curr_frontier = bfs->next_frontier;
+      bfs->next_frontier = frontier;
+      bfs->next_word = 0;
+      bfs->level++;
+      bfs->done = frontier_size == 0;
+      num_levels++;
+    }
+    pthread_barrier_wait(&bfs->barrier);
   }
+  return NULL;
+}
+
+/**
+ * @fn bfs_cpu
+ * @brief Runs a direction-optimizing BFS from each root on the host, with num_threads threads, and prints node levels
+ * of each root as the DPU algorithms do. The graph is a single partition. The traversal is timed as dpu_compute_time.
+ * @param csr the out-edges of the graph.
+ * @param csc the in-edges of the graph.
+ */
+void bfs_cpu(struct CSR *csr, struct CSC *csc) {
+
+  uint32_t total_nodes = csr->num_rows;
+  uint32_t len_frontier = total_nodes / 32;
+  struct cpu_bfs bfs = {.csr = csr, .csc = csc, .len_frontier = len_frontier};
+  bfs.visited = malloc(len_frontier * sizeof(uint32_t));
+  bfs.curr_frontier = malloc(len_frontier * sizeof(uint32_t));
+  bfs.next_frontier = malloc(len_frontier * sizeof(uint32_t));
+  bfs.node_levels = malloc(total_nodes * sizeof(uint32_t));
+  bfs.frontier_sizes = malloc(num_threads * sizeof(uint32_t));
+  bfs.frontier_edges = malloc(num_threads * sizeof(uint64_t));
+  pthread_barrier_init(&bfs.barrier, NULL, num_threads);
+
+  direction.num_nodes = total_nodes;
+  direction.num_edges = csr->num_edges;
+
+  for (uint32_t r = 0; r < num_roots; ++r) {
+    uint32_t root = roots[r];
+    if (root >= total_nodes) {
+      PRINT_ERROR("Root %u is not a node of the graph.", root);
+      exit(1);
+    }
+    uint32_t node = new_ids ? new_ids[root] : root; // ID of the root in the partition.
+
+    open_output(root);
 
 #if BENCHMARK_TIME
-  stop_time(&pop_mram_timer);
-  pop_mram_time = get_elapsed_time(pop_mram_timer);
+    double dpu_compute_start = dpu_compute_time;
+    start_time(&dpu_compute_timer);
 #endif
 
-  // Free resources.
-  free(frontier);
-  for (int i = 0; i < num_dpu; ++i)
-    free_coo(coo[i]);
+    // Reset BFS data.
+    memset(bfs.visited, 0, len_frontier * sizeof(uint32_t));
+    memset(bfs.curr_frontier, 0, len_frontier * sizeof(uint32_t));
+    memset(bfs.node_levels, 0, total_nodes * sizeof(uint32_t));
+    bfs.visited[node / 32] = 1u << node % 32;
+    bfs.curr_frontier[node / 32] = 1u << node % 32;
+    bfs.level = 0;
+    bfs.done = false;
+    bfs.next_word = 0;
+    direction.edges_to_check = direction.num_edges - (csr->row_ptrs[node + 1] - csr->row_ptrs[node]);
+    direction.frontier_size = 1;
+    direction.mode = TopDown;
+
+    // Start BFS algorithm.
+    PRINT_INFO("Starting BFS algorithm from root %u.", root);
+    pthread_t threads[num_threads];
+    struct cpu_worker workers[num_threads];
+    for (uint32_t t = 0; t < num_threads; ++t) {
+      workers[t] = (struct cpu_worker){.bfs = &bfs, .id = t};
+      pthread_create(&threads[t], NULL, cpu_levels, &workers[t]);
+    }
+    for (uint32_t t = 0; t < num_threads; ++t)
+      pthread_join(threads[t], NULL);
 
-  // Start BFS algorithm.
-  PRINT_INFO("Starting BFS algorithm.");
-  if (prt == Row)
-    start_row(len_cf, len_nf);
-  else if (prt == Col)
-    start_col(len_cf, len_nf);
-  else
-    start_2d(len_frontier, len_cf, len_nf, col_div);
+#if BENCHMARK_TIME
+    stop_time(&dpu_compute_timer);
+    dpu_compute_time += get_elapsed_time(dpu_compute_timer);
+#endif
+
+    // Print node levels.
+    fprintf(out, "node\tlevel\n");
+    write_node_levels(bfs.node_levels, total_nodes, root);
+    fclose(out);
+
+#if BENCHMARK_TIME
+    if (batch)
+      printf("root %u dpu_compute_time %f host_comm_time %f host_aggr_time %f total_alg %f\n", root,
+             dpu_compute_time - dpu_compute_start, 0.0, 0.0, dpu_compute_time - dpu_compute_start);
+#endif
+  }
 
-  // Print node levels.
-  print_node_levels(total_nodes, len_nl, 1);
+  pthread_barrier_destroy(&bfs.barrier);
+  free(bfs.frontier_edges);
+  free(bfs.frontier_sizes);
+  free(bfs.node_levels);
+  free(bfs.next_frontier);
+  free(bfs.curr_frontier);
+  free(bfs.visited);
 }
 
 // Cache DPU variable symbols for better performance.
 void cache_symbols(struct dpu_program_t *program) {
   DPU_ASSERT(dpu_get_symbol(program, "__sys_used_mram_end", &mram_heap_sym));
-  DPU_ASSERT(dpu_get_symbol(program, "level", &level_sym));
-  DPU_ASSERT(dpu_get_symbol(program, "nf_updated", &nf_updated_sym));
+  DPU_ASSERT(dpu_get_symbol(program, "mailbox", &mailbox_sym));
+
+  // All DPUs run the same program, so their MRAM heap starts at the same address.
+  DPU_FOREACH(set, dpu) {
+    DPU_ASSERT(dpu_copy_from(dpu, "p_used_mram_end", 0, &mram_heap_start, sizeof(mram_addr_t)));
+    break;
+  }
 }
 
 int main(int argc, char **argv) {
 
   enum Algorithm alg = TopDown;
   enum Partition prt = Row;
-  char *bin_path;
   char *file = NULL;
   char *out_file = NULL;
-  parse_args(argc, argv, &num_dpu, &alg, &prt, &bin_path, &file, &out_file);
-  out = fopen(out_file, "w");
+  uint32_t root = 0;
+  num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  char *roots_file = NULL;
+  char *cache_file = NULL;
+  parse_args(argc, argv, &num_dpu, &alg, &prt, &file, &out_file, &root, &roots_file, &cache_file);
+  out_path = out_file;
+
+  if (roots_file != NULL) {
+    batch = true;
+    roots = load_roots(roots_file, &num_roots);
+  } else {
+    roots = &root;
+    num_roots = 1;
+  }
 
-  PRINT_INFO("Allocating %u DPUs, %u tasklets each. Using %u bytes blocks for MRAM DMA.", num_dpu, NR_TASKLETS, BLOCK_SIZE);
-  struct dpu_program_t *program;
-  DPU_ASSERT(dpu_alloc(num_dpu, NULL, &set));
-  DPU_ASSERT(dpu_load(set, bin_path, &program));
-  cache_symbols(program);
+  // Load the graph partitions from a graph cache file, or build them from the datafile.
+  bool tuned = auto_alg || auto_prt || auto_dpu;
+  struct Graph graph;
+  if (is_graph_cache(file)) {
+    if (tuned)
+      cache_config(file, &num_dpu, &alg, &prt);
+    graph = load_graph_cache(file, num_dpu, alg, prt);
+  } else if (stream_load) {
+    uint32_t padding;
+    graph = load_partitions(file, num_dpu, prt, alg, &padding);
+    if (cache_file != NULL)
+      save_graph_cache(cache_file, graph, num_dpu, prt, padding);
+  } else {
+    // Balanced partitions only need the nodes padded to 32, as their ranges are not all as large. So does a number
+    // of DPUs not chosen yet, as the nodes are padded again once it is.
+    uint32_t padding;
+    struct COO coo = load_coo(file, balanced || auto_dpu ? 1 : num_dpu, &padding);
+    if (tuned || BENCHMARK_TIME) {
+      stats = compute_stats(&coo, padding);
+      has_stats = true;
+    }
+    if (tuned)
+      tune_config(&stats, &num_dpu, &alg, &prt);
+    if (auto_dpu && !balanced)
+      padding += pad_nodes(&coo, num_dpu);
+    if (order != OrderNone)
+      reorder_coo(&coo, order);
+    if (prt == _2D) {
+      struct edge_sample sample = sample_edges(&coo);
+      choose_grid(&sample, num_dpu, alg);
+      free(sample.block_counts);
+    }
+    struct COO *coo_prts = partition_coo(coo, num_dpu, prt, alg);
+    free_coo(coo);
+    graph = build_graph(coo_prts, num_dpu, alg);
+    if (cache_file != NULL)
+      save_graph_cache(cache_file, graph, num_dpu, prt, padding);
+  }
 
-  struct COO coo = load_coo(file, num_dpu);
-  struct COO *coo_prts = partition_coo(coo, num_dpu, prt);
-  free_coo(coo);
+  // The host BFS does not use DPUs.
+  struct dpu_program_t *program;
+  if (alg != Cpu) {
+    PRINT_INFO("Allocating %u DPUs, %u tasklets each. Using %u bytes blocks for MRAM DMA.", num_dpu, NR_TASKLETS, BLOCK_SIZE);
+    DPU_ASSERT(dpu_alloc(num_dpu, NULL, &set));
+    DPU_ASSERT(dpu_load(set, dpu_binary(alg), &program));
+    cache_symbols(program);
+
+    // Predict the time of a level with the partitions made, to compare it with the measured times.
+    uint32_t row_div = prt == Row ? num_dpu : 1;
+    uint32_t col_div = prt == Col ? num_dpu : 1;
+    if (prt == _2D)
+      grid_2d(num_dpu, &row_div, &col_div);
+    uint64_t max_edges = 0;
+    for (uint32_t i = 0; i < num_dpu; ++i) {
+      uint64_t edges = graph.coo ? graph.coo[i].num_edges : graph.csr ? graph.csr[i].num_edges : graph.csc[i].num_edges;
+      max_edges = edges > max_edges ? edges : max_edges;
+    }
+    predicted = predict_level(row_div, col_div, row_starts[row_div], max_edges);
+    PRINT_INFO("Predicted %.3f ms per level (transfers %.3f, merge %.3f, DPU %.3f).", (predicted.comm + predicted.aggr + predicted.dpu) * 1e3,
+               predicted.comm * 1e3, predicted.aggr * 1e3, predicted.dpu * 1e3);
+  }
 
   if (alg == TopDown)
-    bfs_top_down(coo_prts, num_dpu, prt);
+    bfs_top_down(graph.csr, num_dpu, prt);
   else if (alg == BottomUp) {
-    bfs_bottom_up(coo_prts, num_dpu, prt);
+    bfs_bottom_up(graph.csc, num_dpu, prt);
   } else if (alg == Edge) {
-    bfs_edge(coo_prts, num_dpu, prt);
+    bfs_edge(graph.coo, num_dpu, prt);
+  } else if (alg == Hybrid) {
+    bfs_hybrid(graph.csr, graph.csc, num_dpu, prt);
+  } else if (alg == Cpu) {
+    bfs_cpu(graph.csr, graph.csc);
   }
 
-  fclose(out);
-  DPU_ASSERT(dpu_free(set));
+  free_graph(graph);
+  free(row_starts);
+  free(col_starts);
+  free(new_ids);
+  if (batch)
+    free(roots);
+  if (alg != Cpu)
+    DPU_ASSERT(dpu_free(set));
   PRINT_INFO("Done");
 
 #if BENCHMARK_TIME
@@ -1193,8 +4084,13 @@ int main(int argc, char **argv) {
   double total_pop_fetch = pop_mram_time + fetch_res_time;
   double total_all = total_alg + total_pop_fetch;
 
-  printf("dpu_compute_time %f host_comm_time %f host_aggr_time %f pop_mram_time %f fetch_res_time %f total_alg %f total_pop_fetch %f total_all %f\n",
-         dpu_compute_time, host_comm_time, host_aggr_time, pop_mram_time, fetch_res_time, total_alg, total_pop_fetch, total_all);
+  printf("dpu_compute_time %f host_comm_time %f host_aggr_time %f pop_mram_time %f fetch_res_time %f total_alg %f total_pop_fetch %f total_all %f frontier_bits %lu\n",
+         dpu_compute_time, host_comm_time, host_aggr_time, pop_mram_time, fetch_res_time, total_alg, total_pop_fetch, total_all, frontier_bits);
+  printf("num_levels %u predicted_dpu_time %f predicted_comm_time %f predicted_aggr_time %f predicted_alg %f\n", num_levels,
+         predicted.dpu * num_levels, predicted.comm * num_levels, predicted.aggr * num_levels, (predicted.dpu + predicted.comm + predicted.aggr) * num_levels);
+  if (has_stats)
+    printf("num_nodes %u num_edges %lu avg_degree %f degree_skew %f diameter %u\n", stats.num_nodes, stats.num_edges, stats.avg_degree,
+           stats.degree_skew, stats.diameter);
 #endif
 
   return 0;